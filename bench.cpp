@@ -0,0 +1,787 @@
+// ================================================================
+// BENCHMARK: FAST GAUSSIAN BLUR
+// ================================================================
+// Đo thời gian blur trên một lưới cấu hình (kích thước ảnh, số kênh, kiểu pixel, sigma,
+// số pass, border policy). Mỗi cấu hình:
+// - cấp phát buffer một lần và chạm trước mọi trang nhớ (page fault không rơi vào phép đo)
+// - chạy vài lần warmup (cache, thread pool, plan) không tính giờ
+// - lặp lại nhiều lần, mỗi lần khôi phục ảnh input ngoài vùng đo
+// - báo cáo median, p95, min, trung bình, độ lệch chuẩn và MP/s (theo median)
+//
+// Kết quả in ra bảng và có thể ghi CSV/JSON (--csv, --json) để vẽ lại đồ thị data/time.png
+// (thời gian theo số pixel).
+//
+// Bản biên dịch với FGB_STATS=1 (make bench_stats) in thêm thời gian theo giai đoạn (pass ngang,
+// chuyển vị, pass dọc, chuyển vị ngược) của lần lặp cuối mỗi cấu hình, và --trace ghi trace JSON
+// của Chrome cho lần lặp cuối của cấu hình cuối.
+//
+// Với --perf (Linux), mỗi giai đoạn (N pass ngang, chuyển vị, N pass dọc, chuyển vị ngược) được
+// chạy riêng, tuần tự trên thread gọi, trong lúc đọc bộ đếm phần cứng perf_event (cycles,
+// instructions, LLC misses, dTLB misses): kết quả tính theo pixel, để thấy ngay nguyên nhân cache/TLB
+// khi một giai đoạn chậm đi theo kích thước ảnh. Bộ đếm không mở được (VM, perf_event_paranoid)
+// được báo là n/a.
+//
+// Với --roofline, băng thông bộ nhớ khả dụng của máy được đo trước bằng một probe kiểu STREAM
+// (copy và triad, trên mọi worker của backend) và mỗi cấu hình được báo theo phần trăm giới hạn
+// đó, với lưu lượng mô hình (2N pass + 2 chuyển vị) x (đọc + ghi) x kích thước ảnh: gần 100% là
+// giới hạn bởi băng thông, thấp hơn nhiều là giới hạn bởi tính toán / độ trễ. Trên 100% nghĩa là
+// dữ liệu giữa các pass nằm lại trong cache (blur_graph xử lý band vừa L2).
+//
+// Với --accuracy, mỗi cấu hình còn được so với một Gaussian thật (tích chập tách được, độ chính
+// xác double, cùng border policy) và báo PSNR, sai số lớn nhất và sigma thực sự đạt được bên cạnh
+// thông lượng. Nếu không chỉ định, chế độ này quét ảnh 128x128, mọi border policy, 1..5 pass và
+// ba chế độ kernel (kSmall, kMid, kLarge: bán kính box < w/2, < w, >= w).
+//
+// Với --check (make test), quét --accuracy trên u8, u16 và f32 (không warmup, một lần lặp) được so
+// với ngưỡng PSNR tối thiểu và sai số lớn nhất (chuẩn hóa theo đỉnh của T) của từng chế độ kernel;
+// mọi cấu hình vượt ngưỡng được in ra và chương trình trả về mã lỗi khác 0.
+//
+// --boxes chọn cách xấp xỉ sigma: integer (box độ rộng lẻ nguyên, mặc định) hoặc extended (extended
+// box có trọng số lẻ ở hai đầu, đạt đúng sigma); "--boxes integer,extended --accuracy" so sánh cả hai.
+//
+// Cú pháp:
+//   ./bench [--sizes 256,512,...] [--channels 1,3,4] [--types u8,u16,f32] [--sigmas 5]
+//           [--passes 3] [--borders mirror,extend,crop,wrap] [--warmup 3] [--reps 15]
+//           [--csv file] [--json file] [--trace file] [--perf] [--roofline] [--stream-mb 128]
+//           [--accuracy] [--check] [--boxes integer,extended]
+//
+// ================================================================
+
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <fstream>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define USE_OPENMP 1
+#include "fast_gaussian_blur_template.h"
+
+// ================================================================
+// CẤU HÌNH VÀ KẾT QUẢ
+// ================================================================
+
+struct BenchConfig {
+    std::vector<int> sizes = { 256, 512, 1024, 2048, 4096 };   // cạnh ảnh vuông (pixel)
+    std::vector<int> channels = { 3 };
+    std::vector<std::string> types = { "u8" };
+    std::vector<float> sigmas = { 5.f };
+    std::vector<int> passes = { 3 };
+    std::vector<std::string> borders = { "mirror" };
+    std::vector<std::string> boxes = { "integer" };
+    int warmup = 3;
+    int reps = 15;
+    std::string csv, json, trace;
+    bool perf = false;
+    bool roofline = false;
+    int stream_mb = 128;            // kích thước mỗi mảng của probe STREAM (MB), lớn hơn LLC
+    double stream_copy_gbs = 0;     // kết quả probe (--roofline)
+    bool accuracy = false;
+    bool check = false;             // --accuracy + so với ngưỡng theo chế độ kernel, mã lỗi khi vượt
+    std::vector<std::string> given; // các tham số được chỉ định trên dòng lệnh
+};
+
+// Bộ đếm phần cứng đọc quanh mỗi giai đoạn
+enum PerfCounter { kCycles, kInstructions, kLLCMisses, kDTLBMisses, kCounterCount };
+const char * const counter_names[kCounterCount] = { "cycles", "instructions", "llc_misses", "dtlb_misses" };
+
+// Thống kê của một cấu hình
+struct BenchResult {
+    std::string type, border, box;
+    int width, height, channels, passes;
+    float sigma;
+    double median_ms, p95_ms, min_ms, mean_ms, stddev_ms;
+    double mpix_per_s;              // megapixel/giây theo median
+    double bytes_moved;             // lưu lượng mô hình: (2N + 2) x (đọc + ghi) x kích thước ảnh
+    double achieved_gbs;            // bytes_moved / median
+    double bandwidth_pct;           // achieved_gbs / STREAM copy (--roofline), < 0 nếu không đo
+    std::string regime;             // chế độ kernel của box lớn nhất: small / mid / large (--accuracy)
+    double sigma_approx;            // sigma thực sự của chuỗi box (sigma_to_boxes)
+    double psnr_db, max_error;      // so với Gaussian thật, max_error theo đơn vị của T
+    double perf[kStageCount][kCounterCount];    // số đếm / pixel theo giai đoạn (--perf), < 0 nếu n/a
+};
+
+// Tách danh sách "a,b,c"
+std::vector<std::string> split_list(const std::string& text) {
+    std::vector<std::string> items;
+    std::size_t begin = 0;
+    while (begin <= text.size()) {
+        const std::size_t end = std::min(text.find(',', begin), text.size());
+        if (end > begin) items.push_back(text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return items;
+}
+
+template<typename V>
+std::vector<V> parse_list(const std::string& text) {
+    std::vector<V> values;
+    for (const std::string& item : split_list(text))
+        values.push_back(V(std::atof(item.c_str())));
+    return values;
+}
+
+Border parse_border(const std::string& policy) {
+    if (policy == "extend")    return Border::kExtend;
+    if (policy == "crop")      return Border::kKernelCrop;
+    if (policy == "wrap")      return Border::kWrap;
+    return Border::kMirror;
+}
+
+BoxMode parse_box(const std::string& mode) {
+    return mode == "extended" ? kBoxExtended : kBoxInteger;
+}
+
+// Giá trị phân vị theo nearest-rank trên mảng đã sắp xếp
+double percentile(const std::vector<double>& sorted, double p) {
+    const std::size_t rank = std::size_t(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+// ================================================================
+// BỘ ĐẾM PHẦN CỨNG (PERF_EVENT)
+// ================================================================
+
+// Bộ đếm perf_event của thread gọi (chỉ user space). Mỗi bộ đếm mở riêng để bộ đếm nào không có
+// trên máy (thường là dTLB trong VM) không làm hỏng các bộ đếm còn lại
+class PerfCounters {
+public:
+    PerfCounters() {
+        std::fill(fds, fds + kCounterCount, -1);
+#if defined(__linux__)
+        const uint64_t read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const uint32_t types[kCounterCount] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE };
+        const uint64_t configs[kCounterCount] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                  PERF_COUNT_HW_CACHE_LL | read_miss, PERF_COUNT_HW_CACHE_DTLB | read_miss };
+        for (int i = 0; i < kCounterCount; ++i) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[i];
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    ~PerfCounters() {
+#if defined(__linux__)
+        for (int fd : fds) if (fd >= 0) close(fd);
+#endif
+    }
+
+    bool available() const {
+        return std::any_of(fds, fds + kCounterCount, [](int fd){ return fd >= 0; });
+    }
+
+    void start() {
+#if defined(__linux__)
+        for (int fd : fds) if (fd >= 0) { ioctl(fd, PERF_EVENT_IOC_RESET, 0); ioctl(fd, PERF_EVENT_IOC_ENABLE, 0); }
+#endif
+    }
+
+    // Dừng và cộng số đếm vào totals (-1 cho bộ đếm không có)
+    void stop(double totals[kCounterCount]) {
+        for (int i = 0; i < kCounterCount; ++i) {
+            uint64_t value = 0;
+#if defined(__linux__)
+            if (fds[i] >= 0) {
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fds[i], &value, sizeof(value)) == sizeof(value)) {
+                    totals[i] = std::max(0.0, totals[i]) + double(value);
+                    continue;
+                }
+            }
+#endif
+            totals[i] = -1;
+        }
+    }
+
+private:
+    int fds[kCounterCount];
+};
+
+// Các giai đoạn của pipeline, tuần tự trên thread gọi, với đúng kernel và block của bản song song
+template<typename T, int C, Border P>
+void run_stage(int stage, T * in, T * out, int w, int h, const int * boxes, const float * alphas, int n) {
+    const BlurPlan& plan = blur_plan();
+    switch (stage) {
+        case kStageHorizontal:
+        case kStageVertical:
+            // pass dọc = pass ngang trên ảnh chuyển vị (h x w)
+            if (stage == kStageVertical) std::swap(w, h);
+            for (int i = 0; i < n; ++i) {
+                horizontal_blur_rows<T,C,P>(in, out, w, h, boxes[i], alphas[i]);
+                std::swap(in, out);
+            }
+            break;
+        case kStageFlip:
+            flip_block_team<T,C>(in, out, w, h, plan);
+            break;
+        case kStageFlipBack:
+            flip_block_team<T,C>(in, out, h, w, plan, plan.stream_output(w, h));
+            break;
+    }
+}
+
+template<typename T, int C>
+void run_stage(int stage, T * in, T * out, int w, int h, const int * boxes, const float * alphas, int n, Border border) {
+    switch (border) {
+        case kExtend:       run_stage<T,C,kExtend>    (stage, in, out, w, h, boxes, alphas, n); break;
+        case kMirror:       run_stage<T,C,kMirror>    (stage, in, out, w, h, boxes, alphas, n); break;
+        case kKernelCrop:   run_stage<T,C,kKernelCrop>(stage, in, out, w, h, boxes, alphas, n); break;
+        case kWrap:         run_stage<T,C,kWrap>      (stage, in, out, w, h, boxes, alphas, n); break;
+    }
+}
+
+// Đo bộ đếm của từng giai đoạn (warmup rồi reps lần), lưu số đếm trung bình / pixel vào result
+template<typename T>
+void measure_stages(const BenchConfig& config, BenchResult& result, T * input, T * output) {
+    PerfCounters counters;
+    const int w = result.width, h = result.height, c = result.channels;
+    std::vector<int> boxes(result.passes);
+    std::vector<float> alphas(result.passes);
+    sigma_to_boxes(boxes.data(), alphas.data(), result.sigma, result.passes, parse_box(result.box));
+    const Border border = parse_border(result.border);
+
+    for (int stage = 0; stage < kStageCount; ++stage) {
+        double totals[kCounterCount] = {};
+        for (int rep = 0; rep < config.warmup + config.reps; ++rep) {
+            const bool measured = rep >= config.warmup;
+            if (measured) counters.start();
+            switch (c) {
+                case 1: run_stage<T,1>(stage, input, output, w, h, boxes.data(), alphas.data(), result.passes, border); break;
+                case 2: run_stage<T,2>(stage, input, output, w, h, boxes.data(), alphas.data(), result.passes, border); break;
+                case 3: run_stage<T,3>(stage, input, output, w, h, boxes.data(), alphas.data(), result.passes, border); break;
+                case 4: run_stage<T,4>(stage, input, output, w, h, boxes.data(), alphas.data(), result.passes, border); break;
+            }
+            if (measured) counters.stop(totals);
+        }
+        for (int k = 0; k < kCounterCount; ++k)
+            result.perf[stage][k] = totals[k] < 0 ? -1 : totals[k] / config.reps / (double(w) * h);
+    }
+}
+
+void print_perf(const BenchResult& r) {
+    printf("      %-11s %11s %11s %7s %11s %11s\n", "stage", "cycles/px", "instr/px", "IPC", "LLC-miss/px", "dTLB-miss/px");
+    for (int stage = 0; stage < kStageCount; ++stage) {
+        const double * v = r.perf[stage];
+        printf("      %-11s", blur_stage_name(stage));
+        for (int k : { kCycles, kInstructions }) {
+            if (v[k] < 0) printf(" %11s", "n/a");
+            else printf(" %11.2f", v[k]);
+        }
+        if (v[kCycles] > 0 && v[kInstructions] >= 0) printf(" %7.2f", v[kInstructions] / v[kCycles]);
+        else printf(" %7s", "n/a");
+        for (int k : { kLLCMisses, kDTLBMisses }) {
+            if (v[k] < 0) printf(" %11s", "n/a");
+            else printf(" %11.4f", v[k]);
+        }
+        printf("\n");
+    }
+}
+
+// ================================================================
+// ROOFLINE: PROBE BĂNG THÔNG KIỂU STREAM
+// ================================================================
+
+struct StreamBandwidth {
+    double copy_gbs;                // c = a: đọc + ghi
+    double triad_gbs;               // a = b + s*c: 2 đọc + 1 ghi
+};
+
+// Băng thông tốt nhất trên mọi worker của backend hiện tại (như blur). Mỗi worker khởi tạo và xử
+// lý cùng một đoạn của các mảng (first-touch), lưu lượng tính theo quy ước của STREAM
+StreamBandwidth measure_stream(std::size_t bytes_per_array, int reps) {
+    const std::size_t count = bytes_per_array / sizeof(double);
+    double * a = first_touch_alloc<double>(count, false);
+    double * b = first_touch_alloc<double>(count, false);
+    double * c = first_touch_alloc<double>(count, false);
+    const int workers = worker_count();
+    const auto chunk = [&](int i, std::size_t& begin, std::size_t& end) {
+        begin = count * i / workers;
+        end = count * (i + 1) / workers;
+    };
+    run_workers(workers, [&](int i) {
+        std::size_t begin, end;
+        chunk(i, begin, end);
+        for (std::size_t j = begin; j < end; ++j) { a[j] = 1.0; b[j] = 2.0; c[j] = 0.0; }
+    });
+
+    const auto best_time = [&](auto&& kernel) {
+        double best = 1e30;
+        for (int rep = 0; rep < reps; ++rep) {
+            const auto start = std::chrono::steady_clock::now();
+            run_workers(workers, [&](int i) {
+                std::size_t begin, end;
+                chunk(i, begin, end);
+                kernel(begin, end);
+            });
+            const auto end = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double>(end - start).count());
+        }
+        return best;
+    };
+    const double copy = best_time([&](std::size_t begin, std::size_t end) {
+        for (std::size_t j = begin; j < end; ++j) c[j] = a[j];
+    });
+    const double triad = best_time([&](std::size_t begin, std::size_t end) {
+        for (std::size_t j = begin; j < end; ++j) a[j] = b[j] + 3.0 * c[j];
+    });
+
+    first_touch_free(a);
+    first_touch_free(b);
+    first_touch_free(c);
+    const double bytes = double(count) * sizeof(double);
+    return { 2 * bytes / copy / 1e9, 3 * bytes / triad / 1e9 };
+}
+
+void print_roofline(const BenchResult& r) {
+    printf("      roofline: %.1f MB moved, %.2f GB/s", r.bytes_moved / 1e6, r.achieved_gbs);
+    if (r.bandwidth_pct >= 0)
+        printf(" = %.0f%% of STREAM copy -> %s\n", r.bandwidth_pct,
+               r.bandwidth_pct >= 100 ? "cache-resident (above DRAM bound)" :
+               r.bandwidth_pct >= 70 ? "bandwidth-bound" : "compute/latency-bound");
+    else
+        printf("\n");
+}
+
+// ================================================================
+// ĐỘ CHÍNH XÁC: SO VỚI GAUSSIAN THẬT
+// ================================================================
+
+// Ma trận tích chập 1D của Gaussian thật trên một dòng dài len với border policy P: out[x] =
+// sum_j M[x*len + j] * in[j]. Các tap ngoài ảnh được gộp vào pixel mà remap_index trỏ tới; với
+// kKernelCrop chúng bị bỏ và kernel được chuẩn hóa lại trên phần còn trong ảnh.
+template<Border P>
+std::vector<double> gaussian_matrix(int len, double sigma) {
+    std::vector<double> matrix(std::size_t(len) * len, 0.0);
+    const int radius = int(std::ceil(6 * sigma));
+    for (int x = 0; x < len; ++x) {
+        double total = 0;
+        for (int k = -radius; k <= radius; ++k) {
+            const double weight = std::exp(-0.5 * k * k / (sigma * sigma));
+            const int j = x + k;
+            if (j < 0 || j >= len) {
+                if (P == kKernelCrop) continue;
+                matrix[std::size_t(x) * len + remap_index<P>(0, len, j)] += weight;
+            }
+            else
+                matrix[std::size_t(x) * len + j] += weight;
+            total += weight;
+        }
+        for (int j = 0; j < len; ++j)
+            matrix[std::size_t(x) * len + j] /= total;
+    }
+    return matrix;
+}
+
+// Gaussian thật tách được (ngang rồi dọc), độ chính xác double
+template<typename T, Border P>
+std::vector<double> reference_blur(const T * in, int w, int h, int c, double sigma) {
+    const std::vector<double> mx = gaussian_matrix<P>(w, sigma), my = gaussian_matrix<P>(h, sigma);
+    std::vector<double> rows(std::size_t(w) * h * c, 0.0), result(rows.size(), 0.0);
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x)
+            for (int j = 0; j < w; ++j) {
+                const double weight = mx[std::size_t(x) * w + j];
+                if (weight == 0) continue;
+                for (int k = 0; k < c; ++k)
+                    rows[(std::size_t(y) * w + x) * c + k] += weight * in[(std::size_t(y) * w + j) * c + k];
+            }
+    for (int y = 0; y < h; ++y)
+        for (int j = 0; j < h; ++j) {
+            const double weight = my[std::size_t(y) * h + j];
+            if (weight == 0) continue;
+            for (std::size_t i = 0; i < std::size_t(w) * c; ++i)
+                result[std::size_t(y) * w * c + i] += weight * rows[std::size_t(j) * w * c + i];
+        }
+    return result;
+}
+
+// Sigma cho box lớn nhất có bán kính khoảng r với n pass (nghịch đảo của sigma_to_box_radius)
+float sigma_for_radius(int r, int n) {
+    const double width = 2.0 * r + 1;
+    return float(std::sqrt(n * (width * width - 1) / 12.0));
+}
+
+// Sigma mặc định của --accuracy: một giá trị cho mỗi chế độ kernel kSmall, kMid, kLarge
+std::vector<float> regime_sigmas(int size, int passes) {
+    return { sigma_for_radius(size / 8, passes), sigma_for_radius(size * 3 / 4, passes), sigma_for_radius(size * 3 / 2, passes) };
+}
+
+// Blur một lần và so với Gaussian thật: PSNR (đỉnh = giá trị lớn nhất của T, 1 với float),
+// sai số lớn nhất, sigma thực sự và chế độ kernel
+template<typename T>
+void measure_accuracy(BenchResult& result, const T * source, T * input, T * output) {
+    const int w = result.width, h = result.height, c = result.channels;
+    const std::size_t count = std::size_t(w) * h * c;
+    std::vector<int> boxes(result.passes);
+    std::vector<float> alphas(result.passes);
+    const BoxMode mode = parse_box(result.box);
+    result.sigma_approx = sigma_to_boxes(boxes.data(), alphas.data(), result.sigma, result.passes, mode);
+    const int radius = *std::max_element(boxes.begin(), boxes.end());
+    const int side = std::min(w, h);
+    result.regime = radius >= side ? "large" : radius >= side / 2 ? "mid" : "small";
+
+    std::memcpy(input, source, count * sizeof(T));
+    T * in = input;
+    T * out = output;
+    const Border border = parse_border(result.border);
+    fast_gaussian_blur(in, out, w, h, c, result.sigma, result.passes, border, mode);
+
+    std::vector<double> reference;
+    switch (border) {
+        case kExtend:       reference = reference_blur<T,kExtend>    (source, w, h, c, result.sigma); break;
+        case kMirror:       reference = reference_blur<T,kMirror>    (source, w, h, c, result.sigma); break;
+        case kKernelCrop:   reference = reference_blur<T,kKernelCrop>(source, w, h, c, result.sigma); break;
+        case kWrap:         reference = reference_blur<T,kWrap>      (source, w, h, c, result.sigma); break;
+    }
+
+    double squared = 0, largest = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        const double error = std::abs(double(out[i]) - reference[i]);
+        squared += error * error;
+        largest = std::max(largest, error);
+    }
+    const double peak = std::is_integral<T>::value ? double(std::numeric_limits<T>::max()) : 1.0;
+    const double mse = squared / count;
+    result.psnr_db = mse > 0 ? 10 * std::log10(peak * peak / mse) : std::numeric_limits<double>::infinity();
+    result.max_error = largest;
+}
+
+// Ngưỡng của --check theo chế độ kernel: PSNR tối thiểu (dB) và sai số lớn nhất chuẩn hóa theo đỉnh
+// của T. kExtend có cột riêng, lỏng hơn: mỗi pass box kéo dài pixel biên nên chuỗi box lệch khỏi
+// Gaussian thật kẹp biên ngay khi kernel chạm tới biên ảnh.
+struct AccuracyBound { const char * regime; double psnr_db, max_error, extend_psnr_db, extend_max_error; };
+const AccuracyBound accuracy_bounds[] = {
+    { "small", 43.0, 0.030, 38.0, 0.120 },
+    { "mid",   52.0, 0.008, 25.0, 0.120 },
+    { "large", 54.0, 0.006, 26.0, 0.100 },
+};
+
+// Trả về false (và in cấu hình) nếu kết quả vượt ngưỡng của chế độ kernel
+bool check_accuracy(const BenchResult& r) {
+    for (const AccuracyBound& bound : accuracy_bounds) {
+        if (r.regime != bound.regime) continue;
+        const bool extend = parse_border(r.border) == kExtend;
+        const double min_psnr = extend ? bound.extend_psnr_db : bound.psnr_db;
+        const double max_error = extend ? bound.extend_max_error : bound.max_error;
+        const double peak = r.type == "u8" ? 255.0 : r.type == "u16" ? 65535.0 : 1.0;
+        if (r.psnr_db >= min_psnr && r.max_error / peak <= max_error)
+            return true;
+        printf("      FAIL: %s %s kernel, PSNR %.2f dB (>= %.1f), max error %.4g (<= %.4g)\n", r.border.c_str(),
+               r.regime.c_str(), r.psnr_db, min_psnr, r.max_error, max_error * peak);
+        return false;
+    }
+    return false;
+}
+
+void print_accuracy(const BenchResult& r) {
+    printf("      accuracy: %-5s kernel, sigma~ %.3f, PSNR %.2f dB, max error %.4g\n",
+           r.regime.c_str(), r.sigma_approx, r.psnr_db, r.max_error);
+}
+
+// ================================================================
+// ĐO MỘT CẤU HÌNH
+// ================================================================
+
+// Ảnh input giả ngẫu nhiên (LCG, cố định giữa các lần chạy) trong miền giá trị của kiểu T
+template<typename T>
+void fill_image(T * data, std::size_t count) {
+    uint32_t state = 12345u;
+    for (std::size_t i = 0; i < count; ++i) {
+        state = state * 1664525u + 1013904223u;
+        const float unit = (state >> 8) * (1.f / 16777216.f);
+        data[i] = std::is_integral<T>::value ? T(unit * std::numeric_limits<T>::max()) : T(unit);
+    }
+}
+
+#if FGB_STATS
+// Thời gian theo giai đoạn của lần blur gần nhất: tổng thời gian bận của mọi thread, băng thông
+// (byte đọc + ghi / thời gian bận) và độ mất cân bằng giữa các thread
+void print_stage_stats(const BlurStats& stats) {
+    printf("      wall %.3f ms, %d workers, imbalance %.2f\n", stats.wall_us / 1e3, stats.workers, stats.imbalance);
+    for (int stage = 0; stage < kStageCount; ++stage) {
+        if (!stats.stage_events[stage]) continue;
+        printf("      %-11s %9.3f ms busy  %6d tasks  %8.2f GB/s\n", blur_stage_name(stage),
+               stats.stage_us[stage] / 1e3, stats.stage_events[stage],
+               stats.stage_bytes[stage] / (stats.stage_us[stage] * 1e3));
+    }
+}
+#endif
+
+template<typename T>
+BenchResult run_case(const BenchConfig& config, const std::string& type, int size, int channels,
+                     float sigma, int passes, const std::string& border, const std::string& box) {
+    const std::size_t count = std::size_t(size) * size * channels;
+    // Buffer first-touch, đã chạm trước: không còn page fault trong vùng đo
+    T * source = first_touch_alloc<T>(count);
+    T * input = first_touch_alloc<T>(count);
+    T * output = first_touch_alloc<T>(count);
+    fill_image(source, count);
+
+    std::vector<double> times;
+    for (int rep = 0; rep < config.warmup + config.reps; ++rep) {
+        std::memcpy(input, source, count * sizeof(T));  // blur ghi đè input, khôi phục ngoài vùng đo
+        T * in = input;
+        T * out = output;
+        const auto start = std::chrono::steady_clock::now();
+        fast_gaussian_blur(in, out, size, size, channels, sigma, passes, parse_border(border), parse_box(box));
+        const auto end = std::chrono::steady_clock::now();
+        if (rep >= config.warmup)
+            times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    BenchResult result;
+    result.type = type;
+    result.border = border;
+    result.box = box;
+    result.width = result.height = size;
+    result.channels = channels;
+    result.passes = passes;
+    result.sigma = sigma;
+    std::fill(&result.perf[0][0], &result.perf[0][0] + kStageCount * kCounterCount, -1.0);
+    if (config.perf)
+        measure_stages(config, result, input, output);
+    result.sigma_approx = result.psnr_db = result.max_error = -1;
+    if (config.accuracy)
+        measure_accuracy(result, source, input, output);
+
+    first_touch_free(source);
+    first_touch_free(input);
+    first_touch_free(output);
+
+#if FGB_STATS
+    print_stage_stats(last_blur_stats());
+    if (!config.trace.empty())
+        write_chrome_trace(last_blur_stats(), config.trace.c_str());
+#endif
+
+    std::sort(times.begin(), times.end());
+    const double mean = std::accumulate(times.begin(), times.end(), 0.0) / times.size();
+    double variance = 0;
+    for (double t : times) variance += (t - mean) * (t - mean);
+    result.median_ms = times.size() % 2 ? times[times.size() / 2]
+                                        : 0.5 * (times[times.size() / 2 - 1] + times[times.size() / 2]);
+    result.p95_ms = percentile(times, 95);
+    result.min_ms = times.front();
+    result.mean_ms = mean;
+    result.stddev_ms = times.size() > 1 ? std::sqrt(variance / (times.size() - 1)) : 0.0;
+    result.mpix_per_s = double(size) * size / (result.median_ms * 1e3);
+    result.bytes_moved = double(2 * passes + 2) * 2 * count * sizeof(T);
+    result.achieved_gbs = result.bytes_moved / (result.median_ms * 1e6);
+    result.bandwidth_pct = config.stream_copy_gbs > 0 ? 100 * result.achieved_gbs / config.stream_copy_gbs : -1;
+    return result;
+}
+
+// ================================================================
+// XUẤT KẾT QUẢ
+// ================================================================
+
+void print_row(const BenchResult& r) {
+    std::cout << std::fixed << std::setprecision(3)
+              << std::setw(4) << r.type << std::setw(7) << r.width << "x" << std::left << std::setw(6) << r.height
+              << std::right << std::setw(3) << r.channels << std::setw(7) << std::setprecision(1) << r.sigma
+              << std::setw(4) << r.passes << std::setw(8) << r.border << std::setw(9) << r.box << std::setprecision(3)
+              << std::setw(11) << r.median_ms << std::setw(11) << r.p95_ms << std::setw(11) << r.min_ms
+              << std::setw(10) << r.stddev_ms << std::setprecision(1) << std::setw(10) << r.mpix_per_s << "\n";
+}
+
+// Với --perf, thêm một cột <giai đoạn>_<bộ đếm>_per_px cho mỗi cặp (rỗng nếu n/a)
+void write_csv(const std::string& path, const BenchConfig& config, const std::vector<BenchResult>& results) {
+    std::ofstream file(path);
+    file << "type,width,height,pixels,channels,sigma,passes,border,box,median_ms,p95_ms,min_ms,mean_ms,stddev_ms,mpix_per_s,"
+            "bytes_moved,achieved_gbs,bandwidth_pct";
+    if (config.accuracy)
+        file << ",regime,sigma_approx,psnr_db,max_error";
+    if (config.perf)
+        for (int stage = 0; stage < kStageCount; ++stage)
+            for (int k = 0; k < kCounterCount; ++k)
+                file << "," << blur_stage_name(stage) << "_" << counter_names[k] << "_per_px";
+    file << "\n" << std::setprecision(6);
+    for (const BenchResult& r : results) {
+        file << r.type << "," << r.width << "," << r.height << "," << std::size_t(r.width) * r.height << ","
+             << r.channels << "," << r.sigma << "," << r.passes << "," << r.border << "," << r.box << ","
+             << r.median_ms << "," << r.p95_ms << "," << r.min_ms << "," << r.mean_ms << ","
+             << r.stddev_ms << "," << r.mpix_per_s << "," << (unsigned long long)r.bytes_moved << "," << r.achieved_gbs << ",";
+        if (r.bandwidth_pct >= 0) file << r.bandwidth_pct;
+        if (config.accuracy)
+            file << "," << r.regime << "," << r.sigma_approx << "," << r.psnr_db << "," << r.max_error;
+        if (config.perf)
+            for (int stage = 0; stage < kStageCount; ++stage)
+                for (int k = 0; k < kCounterCount; ++k) {
+                    file << ",";
+                    if (r.perf[stage][k] >= 0) file << r.perf[stage][k];
+                }
+        file << "\n";
+    }
+}
+
+void write_json(const std::string& path, const BenchConfig& config, const std::vector<BenchResult>& results) {
+    std::ofstream file(path);
+    file << std::setprecision(6);
+    file << "{\n  \"warmup\": " << config.warmup << ",\n  \"reps\": " << config.reps
+         << ",\n  \"threads\": " << worker_count();
+    if (config.stream_copy_gbs > 0)
+        file << ",\n  \"stream_copy_gbs\": " << config.stream_copy_gbs;
+    file << ",\n  \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        file << "    {\"type\": \"" << r.type << "\", \"width\": " << r.width << ", \"height\": " << r.height
+             << ", \"pixels\": " << std::size_t(r.width) * r.height << ", \"channels\": " << r.channels
+             << ", \"sigma\": " << r.sigma << ", \"passes\": " << r.passes << ", \"border\": \"" << r.border
+             << "\", \"box\": \"" << r.box << "\", \"median_ms\": " << r.median_ms << ", \"p95_ms\": " << r.p95_ms << ", \"min_ms\": " << r.min_ms
+             << ", \"mean_ms\": " << r.mean_ms << ", \"stddev_ms\": " << r.stddev_ms
+             << ", \"mpix_per_s\": " << r.mpix_per_s << ", \"bytes_moved\": " << (unsigned long long)r.bytes_moved
+             << ", \"achieved_gbs\": " << r.achieved_gbs << ", \"bandwidth_pct\": ";
+        if (r.bandwidth_pct >= 0) file << r.bandwidth_pct;
+        else file << "null";
+        if (config.accuracy) {
+            file << ", \"regime\": \"" << r.regime << "\", \"sigma_approx\": " << r.sigma_approx << ", \"psnr_db\": ";
+            if (std::isfinite(r.psnr_db)) file << r.psnr_db;
+            else file << "null";
+            file << ", \"max_error\": " << r.max_error;
+        }
+        if (config.perf) {
+            file << ", \"perf_per_px\": {";
+            for (int stage = 0; stage < kStageCount; ++stage) {
+                file << (stage ? ", " : "") << "\"" << blur_stage_name(stage) << "\": {";
+                for (int k = 0; k < kCounterCount; ++k) {
+                    file << (k ? ", " : "") << "\"" << counter_names[k] << "\": ";
+                    if (r.perf[stage][k] >= 0) file << r.perf[stage][k];
+                    else file << "null";
+                }
+                file << "}";
+            }
+            file << "}";
+        }
+        file << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+}
+
+// ================================================================
+// HÀM CHÍNH
+// ================================================================
+int main(int argc, char * argv[])
+{
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i) {
+        const std::string key = argv[i];
+        if (key == "--perf" || key == "--roofline" || key == "--accuracy" || key == "--check") {
+            (key == "--perf" ? config.perf : key == "--roofline" ? config.roofline : key == "--check" ? config.check : config.accuracy) = true;
+            config.accuracy = config.accuracy || config.check;
+            continue;
+        }
+        config.given.push_back(key);
+        const std::string value = i + 1 < argc ? argv[++i] : "";
+        if (key == "--sizes")           config.sizes = parse_list<int>(value);
+        else if (key == "--channels")   config.channels = parse_list<int>(value);
+        else if (key == "--types")      config.types = split_list(value);
+        else if (key == "--sigmas")     config.sigmas = parse_list<float>(value);
+        else if (key == "--passes")     config.passes = parse_list<int>(value);
+        else if (key == "--borders")    config.borders = split_list(value);
+        else if (key == "--boxes")      config.boxes = split_list(value);
+        else if (key == "--warmup")     config.warmup = std::max(0, std::atoi(value.c_str()));
+        else if (key == "--reps")       config.reps = std::max(1, std::atoi(value.c_str()));
+        else if (key == "--csv")        config.csv = value;
+        else if (key == "--json")       config.json = value;
+        else if (key == "--trace")      config.trace = value;
+        else if (key == "--stream-mb")  config.stream_mb = std::max(1, std::atoi(value.c_str()));
+        else {
+            printf("Tham số không hợp lệ: %s\n", key.c_str());
+            printf("%s [--sizes 256,512,...] [--channels 1,3,4] [--types u8,u16,f32] [--sigmas 5] [--passes 3]\n"
+                   "      [--borders mirror,extend,crop,wrap] [--warmup 3] [--reps 15] [--csv file] [--json file] [--trace file] [--perf]\n"
+                   "      [--roofline] [--stream-mb 128] [--accuracy] [--check] [--boxes integer,extended]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // --accuracy: quét mặc định riêng (tham chiếu chậm, O(w^3) mỗi cấu hình) cho mọi tham số không
+    // được chỉ định
+    const auto given = [&](const char * key) {
+        return std::find(config.given.begin(), config.given.end(), key) != config.given.end();
+    };
+    if (config.accuracy) {
+        if (!given("--sizes"))      config.sizes = { 128 };
+        if (!given("--passes"))     config.passes = { 1, 2, 3, 4, 5 };
+        if (!given("--borders"))    config.borders = { "extend", "mirror", "crop", "wrap" };
+    }
+    // --check: chỉ cần một lần chạy mỗi cấu hình, trên mọi kiểu pixel
+    if (config.check) {
+        if (!given("--types"))      config.types = { "u8", "u16", "f32" };
+        if (!given("--warmup"))     config.warmup = 0;
+        if (!given("--reps"))       config.reps = 1;
+    }
+
+    printf("Threads: %d, warmup: %d, reps: %d\n", worker_count(), config.warmup, config.reps);
+    if (config.perf && !PerfCounters().available())
+        printf("perf_event: không mở được bộ đếm phần cứng (kiểm tra /proc/sys/kernel/perf_event_paranoid)\n");
+    if (config.roofline) {
+        const StreamBandwidth stream = measure_stream(std::size_t(config.stream_mb) << 20, 10);
+        config.stream_copy_gbs = stream.copy_gbs;
+        printf("STREAM (%d MB/array): copy %.2f GB/s, triad %.2f GB/s\n", config.stream_mb, stream.copy_gbs, stream.triad_gbs);
+    }
+    printf("\n");
+    printf("type          size  c  sigma   n  border      box  median(ms)    p95(ms)    min(ms)  stddev     MP/s\n");
+
+    std::vector<BenchResult> results;
+    int failures = 0;
+    for (const std::string& type : config.types)
+    for (int size : config.sizes)
+    for (int channels : config.channels)
+    for (int passes : config.passes)
+    for (float sigma : config.accuracy && !given("--sigmas") ? regime_sigmas(size, passes) : config.sigmas)
+    for (const std::string& border : config.borders)
+    for (const std::string& box : config.boxes)
+    {
+        BenchResult result;
+        if (type == "u8")
+            result = run_case<uint8_t>(config, type, size, channels, sigma, passes, border, box);
+        else if (type == "u16")
+            result = run_case<uint16_t>(config, type, size, channels, sigma, passes, border, box);
+        else if (type == "f32")
+            result = run_case<float>(config, type, size, channels, sigma, passes, border, box);
+        else {
+            printf("Kiểu pixel không hỗ trợ: %s (u8, u16, f32)\n", type.c_str());
+            return 1;
+        }
+        print_row(result);
+        if (config.perf)
+            print_perf(result);
+        if (config.roofline)
+            print_roofline(result);
+        if (config.accuracy)
+            print_accuracy(result);
+        if (config.check && !check_accuracy(result))
+            ++failures;
+        results.push_back(result);
+    }
+
+    if (!config.csv.empty())  write_csv(config.csv, config, results);
+    if (!config.json.empty()) write_json(config.json, config, results);
+    if (config.check) {
+        printf("\ncheck: %d/%zu cấu hình vượt ngưỡng độ chính xác\n", failures, results.size());
+        return failures ? 1 : 0;
+    }
+    return 0;
+}
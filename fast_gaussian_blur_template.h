@@ -21,13 +21,117 @@
 #endif
 
 // Macro helper để điều kiện hóa pragma OpenMP
+// schedule(static) được ghi rõ: thread t luôn nhận cùng một dải hàng liên tục ở mọi pass,
+// điều kiện cần cho first-touch NUMA (xem first_touch_alloc)
+// OMP_FOR* là worksharing "mồ côi" (orphaned): gọi trong một vùng OMP_PARALLEL thì chia việc
+// cho cả team, gọi ngoài vùng song song thì chạy tuần tự
+// Pragma chỉ được sinh khi compiler bật OpenMP (_OPENMP): USE_OPENMP 1 mà thiếu -fopenmp (make
+// single, make debug) không còn cảnh báo unknown-pragma với -Wall
 #if USE_OPENMP
-    #define OMP_PARALLEL_FOR _Pragma("omp parallel for")
-    #define OMP_PARALLEL_FOR_COLLAPSE_2 _Pragma("omp parallel for collapse(2)")
+    #include <omp.h>
+#endif
+#if USE_OPENMP && defined(_OPENMP)
+    #define OMP_PRAGMA(text) _Pragma(#text)
+    #define OMP_PARALLEL _Pragma("omp parallel")
+    #define OMP_PARALLEL_FOR _Pragma("omp parallel for schedule(static)")
+    #define OMP_PARALLEL_FOR_THREADS(count) OMP_PRAGMA(omp parallel for schedule(static, 1) num_threads(count))
+    #define OMP_FOR_COLLAPSE_2 _Pragma("omp for collapse(2) schedule(static)")
+    #define OMP_BARRIER _Pragma("omp barrier")
 #else
+    #define OMP_PARALLEL
     #define OMP_PARALLEL_FOR
-    #define OMP_PARALLEL_FOR_COLLAPSE_2
+    #define OMP_PARALLEL_FOR_THREADS(count)
+    #define OMP_FOR_COLLAPSE_2
+    #define OMP_BARRIER
+#endif
+
+// ================================================================
+// MACRO ĐIỀU KHIỂN SIMD
+// ================================================================
+// Định nghĩa USE_SIMD=0 trước khi include header để tắt các kernel SIMD (SSE2)
+// Mặc định: bật nếu compiler hỗ trợ SSE2 (mọi CPU x86-64)
+#ifndef USE_SIMD
+    #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #define USE_SIMD 1
+    #else
+        #define USE_SIMD 0
+    #endif
+#endif
+
+#if USE_SIMD
+    #include <emmintrin.h>
+#endif
+
+// Prefetch phần mềm: nạp trước một cache line vào cache (chỉ đọc, giữ ở mọi mức cache)
+#if defined(__GNUC__) || defined(__clang__)
+    #define FGB_PREFETCH(addr) __builtin_prefetch((const void *)(addr), 0, 3)
+#elif USE_SIMD
+    #define FGB_PREFETCH(addr) _mm_prefetch((const char *)(addr), _MM_HINT_T0)
+#else
+    #define FGB_PREFETCH(addr) ((void)0)
+#endif
+
+// Thống kê thời gian theo giai đoạn (xem BlurStats): định nghĩa FGB_STATS=1 trước khi include
+// header để bật. Mặc định tắt và không có chi phí nào
+#ifndef FGB_STATS
+    #define FGB_STATS 0
+#endif
+
+// Gợi ý cho CPU trong vòng chờ bận (spin-wait): giảm tiêu thụ và nhường tài nguyên cho hyperthread
+#if USE_SIMD
+    #define FGB_PAUSE() _mm_pause()
+#else
+    #define FGB_PAUSE() ((void)0)
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+
+#if defined(__linux__)
+    #include <unistd.h>
+    #include <sched.h>
+    #include <pthread.h>
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+#endif
+
+// Các hàm runtime omp_* chỉ được gọi khi build thật sự có OpenMP (_OPENMP, cờ -fopenmp): main.cpp
+// đặt USE_OPENMP 1 nhưng các target single/debug build không có -fopenmp và không link libgomp.
+// Khi đó các pragma bị bỏ qua và mọi vùng "song song" chạy với một thread.
+
+//! Chỉ số của thread hiện tại trong team OpenMP (0 nếu không có OpenMP)
+inline int omp_thread_index()
+{
+#if USE_OPENMP && defined(_OPENMP)
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+//! Số thread trong team OpenMP hiện tại (1 nếu không có OpenMP)
+inline int omp_thread_total()
+{
+#if USE_OPENMP && defined(_OPENMP)
+    return omp_get_num_threads();
+#else
+    return 1;
 #endif
+}
 
 // ================================================================
 // TỔNG QUAN VỀ SONG SONG HÓA (PARALLELIZATION) TRONG CODE NÀY
@@ -52,9 +156,10 @@
 //    - Vị trí: Trong hàm flip_block
 //    - Cách thức: #pragma omp parallel for collapse(2) cho 2 vòng lặp lồng nhau
 //    - Chi tiết: 
-//      * Chia ảnh thành các block nhỏ (256/C pixels)
+//      * Chia ảnh thành các block 2 mức (outer ~ L2, inner ~ L1), kích thước lấy từ BlurPlan
 //      * Mỗi block được transpose độc lập bởi một thread
 //      * collapse(2) làm phẳng 2 vòng lặp để tạo nhiều tasks hơn
+//      * Bên trong block, pixel 1/2/4/8 byte được chuyển vị theo tile SSE2 (xem flip_tile)
 //    - Lợi ích:
 //      * Block-based approach giữ cache locality tốt
 //      * Nhiều tasks hơn = load balancing tốt hơn
@@ -212,6 +317,221 @@ enum Kernel
 template<typename T>
 constexpr float round_v() { return std::is_integral_v<T> ? 0.5f : 0.f; }
 
+// ================================================================
+// KẾ HOẠCH THỰC THI (BLUR PLAN) VÀ AUTOTUNING
+// ================================================================
+//
+// Các tham số phụ thuộc máy (kích thước block chuyển vị, ...) không còn là hằng số
+// compile-time mà được gom vào BlurPlan, khởi tạo một lần ở lần dùng đầu tiên:
+// 1. Nếu biến môi trường FGB_PLAN_FILE trỏ tới một file plan hợp lệ: nạp plan từ file
+// 2. Ngược lại: suy ra từ kích thước cache L1d/L2 của CPU (detect_cache_info)
+// 3. Nếu FGB_AUTOTUNE=1: chạy benchmark nhỏ (autotune_blur_plan) và lưu vào FGB_PLAN_FILE
+//
+// Plan có thể đọc/sửa trực tiếp qua blur_plan() trước khi gọi blur (ví dụ trong benchmark).
+//
+
+//!
+//! \brief Kích thước cache dữ liệu của CPU (byte).
+//!
+struct CacheInfo
+{
+    int l1 = 32*1024;       // L1 data cache mỗi core
+    int l2 = 256*1024;      // L2 cache mỗi core
+};
+
+//!
+//! \brief Đọc kích thước cache L1d và L2 của CPU.
+//! Trên Linux dùng sysconf, nếu không có thì đọc sysfs; các hệ khác giữ giá trị mặc định.
+//!
+inline CacheInfo detect_cache_info()
+{
+    CacheInfo info;
+#if defined(__linux__)
+    long l1 = 0, l2 = 0;
+    #if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+    l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    #endif
+    // Một số libc/container trả về 0: đọc trực tiếp /sys/devices/system/cpu/cpu0/cache
+    for(int index = 0; index < 8 && (l1 <= 0 || l2 <= 0); ++index)
+    {
+        char path[128], type[32] = { 0 };
+        int level = 0, size = 0;
+        std::snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+        FILE * f = std::fopen(path, "r");
+        if( !f ) break;
+        const bool ok_level = std::fscanf(f, "%d", &level) == 1;
+        std::fclose(f);
+        std::snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        if( (f = std::fopen(path, "r")) ) { if( std::fscanf(f, "%31s", type) != 1 ) type[0] = 0; std::fclose(f); }
+        std::snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        if( (f = std::fopen(path, "r")) ) { if( std::fscanf(f, "%dK", &size) != 1 ) size = 0; std::fclose(f); }
+        if( !ok_level || size <= 0 || std::strcmp(type, "Instruction") == 0 ) continue;
+        if( level == 1 && l1 <= 0 ) l1 = size*1024L;
+        if( level == 2 && l2 <= 0 ) l2 = size*1024L;
+    }
+    if( l1 > 0 ) info.l1 = int(l1);
+    if( l2 > 0 ) info.l2 = int(l2);
+#endif
+    return info;
+}
+
+//!
+//! \brief Các tham số điều chỉnh (tuning) dùng chung cho mọi lần gọi blur.
+//!
+//! Kích thước block chuyển vị được lưu dưới dạng ngân sách bộ nhớ (byte, tính cả vùng nguồn
+//! và vùng đích của block) thay vì số pixel, để cùng một plan áp dụng được cho mọi kiểu T và
+//! số kênh C. flip_block dùng 2 mức block:
+//! - block ngoài (outer): đơn vị chia việc giữa các threads, nên nằm gọn trong L2
+//! - block trong (inner): duyệt tuần tự trong block ngoài, nên nằm gọn trong L1
+//!
+struct BlurPlan
+{
+    int flip_l1_bytes = 64*1024;    // ngân sách block trong (inner), mặc định 2*L1: vùng nguồn vừa L1
+    int flip_l2_bytes = 128*1024;   // ngân sách block ngoài (outer), mặc định L2/2
+
+    //! Từ kích thước ảnh này (số pixel) trở lên, lần chuyển vị cuối ghi bằng non-temporal store:
+    //! ảnh lớn hơn LLC nhiều lần không còn trong cache khi caller đọc lại, ghi thẳng ra RAM tránh
+    //! read-for-ownership và không đẩy dữ liệu khác khỏi cache. <= 0 để tắt.
+    long long stream_min_pixels = 30000000;
+
+    //! Khoảng cách prefetch phần mềm:
+    //! - prefetch_row_bytes: số byte đầu của hàng kế tiếp được prefetch khi bắt đầu mỗi hàng trong
+    //!   horizontal_blur, để luồng đọc mới khởi động trước khi hardware prefetcher kịp nhận ra
+    //! - prefetch_flip_tiles: flip_block prefetch các hàng nguồn của tile cách tile hiện tại
+    //!   bấy nhiêu tile theo chiều dọc (các hàng cách nhau w*C phần tử mà prefetcher hay bỏ lỡ)
+    //! 0 để tắt.
+    int prefetch_row_bytes = 256;
+    int prefetch_flip_tiles = 2;
+
+    //! Chế độ lập lịch NUMA: flip_block chia ảnh đích theo dải hàng liên tục, thread t ghi đúng
+    //! phần [t/n, (t+1)/n) của buffer - cùng phần mà thread t ghi trong horizontal_blur
+    //! (horizontal_blur_team) và đã first-touch (first_touch_alloc), ở cả ảnh gốc lẫn ảnh chuyển vị.
+    //! Nên dùng kèm pin_threads() để thread t không đổi node giữa các pass. Chỉ áp dụng cho blur
+    //! cùng số pass hai chiều (nx == ny, xem fast_gaussian_blur bất đẳng hướng).
+    bool numa_bands = false;
+
+    //! Kích thước một dải hàng (band) của blur_graph (byte), mặc định L2/4: dải nguồn, dải đích và
+    //! hai dải tạm của N pass liên tiếp cùng nằm trong L2
+    int band_bytes = 64*1024;
+
+    //! Mô hình chi phí chọn số worker (threads_for): thời gian (ns) cho mỗi phần tử (pixel*kênh) của
+    //! một box pass và của một lần chuyển vị, và chi phí cố định của mỗi worker thêm vào (đánh thức,
+    //! đồng bộ). Hiệu chỉnh trên máy bằng calibrate_cost_model (chạy cùng FGB_AUTOTUNE=1).
+    float cost_pass_ns = 1.2f;
+    float cost_flip_ns = 0.7f;
+    float cost_thread_ns = 5000.f;
+
+    //!
+    //! \brief Số worker tối ưu theo mô hình chi phí: thời gian song song work/t + t*cost_thread_ns
+    //! nhỏ nhất tại t = sqrt(work/cost_thread_ns), kẹp trong [1, max_threads].
+    //!
+    //! \param[in] elements     Số phần tử của ảnh (w*h*c)
+    //! \param[in] pass_units   Tổng trọng số các box pass (1 cho mỗi pass, 2 cho pass có kernel
+    //!                         >= nửa chiều dài hàng, vốn đi nhánh remap chậm hơn)
+    //! \param[in] flips        Số lần chuyển vị
+    //! \param[in] max_threads  Số worker tối đa của backend
+    //!
+    int threads_for(const double elements, const double pass_units, const int flips, const int max_threads) const
+    {
+        const double work = elements * (pass_units*cost_pass_ns + flips*cost_flip_ns);
+        const double best = std::sqrt(work / std::max(cost_thread_ns, 1.f));
+        return int(std::max(1.0, std::min<double>(max_threads, std::floor(best))));
+    }
+
+    //! Số hàng của một band cho hàng dài row_bytes byte (ít nhất 16 hàng để tile chuyển vị
+    //! giữa các band không quá hẹp)
+    int band_rows(const long long row_bytes, const int rows) const
+    {
+        const long long n = std::max<long long>(16, band_bytes / std::max<long long>(row_bytes, 1));
+        return int(std::min<long long>(n, std::max(rows, 1)));
+    }
+
+    //! Cạnh block vuông (pixel) có footprint 2*S*S*B <= budget, làm tròn xuống bội số của K
+    static int block_side(const int budget, const int B, const int K)
+    {
+        const int side = int(std::sqrt(std::max(budget, 1) / (2.0 * B)));
+        return std::max(K, side/K*K);
+    }
+
+    //! Có dùng non-temporal store cho output cuối của ảnh w x h hay không
+    bool stream_output(const int w, const int h) const
+    {
+        return stream_min_pixels > 0 && (long long)w*h >= stream_min_pixels;
+    }
+};
+
+//! Trả về plan dùng chung (khởi tạo ở lần gọi đầu tiên, thread-safe), định nghĩa ở cuối phần chuyển vị
+inline BlurPlan & blur_plan();
+
+//! Đo các hệ số của mô hình chi phí (BlurPlan::threads_for) trên máy hiện tại, định nghĩa sau phần backend
+inline void calibrate_cost_model(BlurPlan & plan);
+
+//!
+//! \brief Lưu plan ra file text dạng "key value" (mỗi dòng một tham số).
+//! \return true nếu ghi thành công
+//!
+inline bool save_blur_plan(const BlurPlan & plan, const char * path)
+{
+    FILE * f = std::fopen(path, "w");
+    if( !f ) return false;
+    std::fprintf(f, "flip_l1_bytes %d\n", plan.flip_l1_bytes);
+    std::fprintf(f, "flip_l2_bytes %d\n", plan.flip_l2_bytes);
+    std::fprintf(f, "stream_min_pixels %lld\n", plan.stream_min_pixels);
+    std::fprintf(f, "prefetch_row_bytes %d\n", plan.prefetch_row_bytes);
+    std::fprintf(f, "prefetch_flip_tiles %d\n", plan.prefetch_flip_tiles);
+    std::fprintf(f, "numa_bands %d\n", int(plan.numa_bands));
+    std::fprintf(f, "band_bytes %d\n", plan.band_bytes);
+    std::fprintf(f, "cost_pass_ns %g\n", plan.cost_pass_ns);
+    std::fprintf(f, "cost_flip_ns %g\n", plan.cost_flip_ns);
+    std::fprintf(f, "cost_thread_ns %g\n", plan.cost_thread_ns);
+    std::fclose(f);
+    return true;
+}
+
+//!
+//! \brief Nạp plan từ file tạo bởi save_blur_plan. Các key không biết được bỏ qua,
+//! các key thiếu giữ nguyên giá trị hiện tại của plan.
+//! \return true nếu đọc được file
+//!
+inline bool load_blur_plan(BlurPlan & plan, const char * path)
+{
+    FILE * f = std::fopen(path, "r");
+    if( !f ) return false;
+    char key[64];
+    double value;
+    while( std::fscanf(f, "%63s %lf", key, &value) == 2 )
+    {
+        if( std::strcmp(key, "flip_l1_bytes") == 0 )        plan.flip_l1_bytes = int(value);
+        else if( std::strcmp(key, "flip_l2_bytes") == 0 )   plan.flip_l2_bytes = int(value);
+        else if( std::strcmp(key, "stream_min_pixels") == 0 ) plan.stream_min_pixels = (long long)value;
+        else if( std::strcmp(key, "prefetch_row_bytes") == 0 ) plan.prefetch_row_bytes = int(value);
+        else if( std::strcmp(key, "prefetch_flip_tiles") == 0 ) plan.prefetch_flip_tiles = int(value);
+        else if( std::strcmp(key, "numa_bands") == 0 )      plan.numa_bands = value != 0;
+        else if( std::strcmp(key, "band_bytes") == 0 )      plan.band_bytes = int(value);
+        else if( std::strcmp(key, "cost_pass_ns") == 0 )    plan.cost_pass_ns = float(value);
+        else if( std::strcmp(key, "cost_flip_ns") == 0 )    plan.cost_flip_ns = float(value);
+        else if( std::strcmp(key, "cost_thread_ns") == 0 )  plan.cost_thread_ns = float(value);
+    }
+    std::fclose(f);
+    return true;
+}
+
+//!
+//! \brief Prefetch `bytes` byte đầu của hàng i+1 (nếu hàng đó tồn tại) trong buffer w x h pixel.
+//! Được gọi ở đầu mỗi hàng của horizontal_blur: mỗi hàng là một luồng đọc mới nên hardware
+//! prefetcher cần vài cache miss để nhận ra; prefetch trước giúp che bớt độ trễ đó.
+//!
+template<typename T, int C>
+inline void prefetch_next_row(const T * in, const int w, const int h, const int i, const int bytes)
+{
+    if( bytes <= 0 || i+1 >= h ) return;
+    const char * p = (const char *)(in + std::ptrdiff_t(i+1)*w*C);
+    const int n = std::min<std::ptrdiff_t>(bytes, std::ptrdiff_t(w)*C*sizeof(T));
+    for(int b = 0; b < n; b += 64)
+        FGB_PREFETCH(p + b);
+}
+
 //!
 //! \brief Hàm này thực hiện một lần box blur theo chiều ngang (horizontal) với chính sách biên extend (mở rộng).
 //! Hàm này được template hóa theo kiểu dữ liệu buffer T và số kênh màu C.
@@ -222,9 +542,10 @@ constexpr float round_v() { return std::is_integral_v<T> ? 0.5f : 0.f; }
 //! \param[in] w            Chiều rộng ảnh (image width)
 //! \param[in] h            Chiều cao ảnh (image height)
 //! \param[in] r            Bán kính box blur (box radius/dimension)
+//! \param[in] prefetch     Số byte đầu của hàng kế tiếp cần prefetch (0: tắt, xem prefetch_next_row)
 //!
 template<typename T, int C, Kernel kernel = kSmall>
-inline void horizontal_blur_extend(const T * in, T * out, const int w, const int h, const int r)
+inline void horizontal_blur_extend(const T * in, T * out, const int w, const int h, const int r, const int prefetch = 0)
 {
     // Thay đổi kiểu biến local dựa trên kiểu template để tính toán nhanh hơn
     // Nếu T là số nguyên (int, uchar...) thì dùng int để tính, nếu là float thì dùng float
@@ -237,37 +558,23 @@ inline void horizontal_blur_extend(const T * in, T * out, const int w, const int
     // ================================================================
     // PHẦN SONG SONG HÓA (PARALLELIZATION) - CHI TIẾT:
     // ================================================================
-    // #pragma omp parallel for: Đây là directive của OpenMP để song song hóa vòng lặp
-    // 
-    // Cách hoạt động:
-    // 1. OpenMP sẽ tự động chia vòng lặp for(int i=0; i<h; i++) thành nhiều phần
-    // 2. Mỗi thread (luồng) sẽ xử lý một nhóm các hàng (rows) khác nhau
-    // 3. Ví dụ: Nếu có 4 threads và h=1000, có thể chia thành:
-    //    - Thread 0: xử lý hàng 0-249
-    //    - Thread 1: xử lý hàng 250-499
-    //    - Thread 2: xử lý hàng 500-749
-    //    - Thread 3: xử lý hàng 750-999
+    // Vòng lặp dưới đây chạy TUẦN TỰ trên h hàng được giao. Song song hóa nằm ở caller,
+    // vốn gọi kernel với con trỏ đã dịch tới đầu một dải hàng (band) và h = số hàng của dải:
+    // - horizontal_blur_team: mỗi thread nhận một dải liên tục [t*h/n, (t+1)*h/n)
+    // - blur_graph: dải nhỏ vừa L2, chạy cả N pass liên tiếp khi dải còn nóng trong cache
     //
     // Lý do song song hóa theo hàng:
     // - Mỗi hàng có thể được xử lý độc lập, không phụ thuộc vào kết quả của hàng khác
     // - Dữ liệu mỗi hàng nằm liên tiếp trong bộ nhớ (cache-friendly)
     // - Việc chia theo hàng tận dụng tốt cache locality
-    //
-    // Lợi ích:
-    // - Tăng tốc đáng kể trên CPU đa nhân (multi-core)
-    // - Tự động load balancing giữa các threads
-    // - Không cần code phức tạp để quản lý threads thủ công
-    //
-    // Lưu ý: Cần compile với flag -fopenmp (GCC/Clang) hoặc /openmp (MSVC)
-    //        và link với thư viện OpenMP
     // ================================================================
-    OMP_PARALLEL_FOR
     for(int i=0; i<h; i++)  // Duyệt qua từng hàng của ảnh 
     {
         // Tính chỉ số bắt đầu và kết thúc của hàng hiện tại trong buffer 1D
         // Buffer được lưu dạng row-major: pixel[y][x][c] = buffer[y*w*C + x*C + c]
         const int begin = i*w;           // Chỉ số bắt đầu hàng i
         const int end = begin+w;         // Chỉ số kết thúc hàng i (không bao gồm)
+        prefetch_next_row<T,C>(in, w, h, i, prefetch);
         
         // Khai báo các biến tích lũy cho thuật toán sliding window:
         calc_type fv[C];  // first value: giá trị pixel đầu tiên của hàng (dùng cho extend)
@@ -429,9 +736,10 @@ inline void horizontal_blur_extend(const T * in, T * out, const int w, const int
 //! \param[in] w            Chiều rộng ảnh (image width)
 //! \param[in] h            Chiều cao ảnh (image height)
 //! \param[in] r            Bán kính box blur (box radius/dimension)
+//! \param[in] prefetch     Số byte đầu của hàng kế tiếp cần prefetch (0: tắt, xem prefetch_next_row)
 //!
 template<typename T, int C, Kernel kernel = kSmall>
-inline void horizontal_blur_kernel_crop(const T * in, T * out, const int w, const int h, const int r)
+inline void horizontal_blur_kernel_crop(const T * in, T * out, const int w, const int h, const int r, const int prefetch = 0)
 {
     // Thay đổi kiểu biến local dựa trên kiểu template để tính toán nhanh hơn
     using calc_type = std::conditional_t<std::is_integral_v<T>, int, float>;
@@ -441,15 +749,12 @@ inline void horizontal_blur_kernel_crop(const T * in, T * out, const int w, cons
     // Tính nghịch đảo chiều rộng ảnh (dùng khi kernel lớn hơn ảnh)
     const float iwidth = 1.f / w;
     
-    // ================================================================
-    // SONG SONG HÓA: Tương tự như horizontal_blur_extend
-    // Mỗi thread xử lý một nhóm hàng độc lập, tăng tốc trên CPU đa nhân
-    // ================================================================
-    OMP_PARALLEL_FOR
+    // Duyệt tuần tự các hàng của dải được giao (song song hóa ở caller, xem horizontal_blur_extend)
     for(int i=0; i<h; i++)  // Duyệt qua từng hàng của ảnh
     {
         const int begin = i*w;
         const int end = begin+w;
+        prefetch_next_row<T,C>(in, w, h, i, prefetch);
         calc_type acc[C] = { 0 };
 
         if constexpr(kernel == kLarge)
@@ -561,10 +866,11 @@ inline void horizontal_blur_kernel_crop(const T * in, T * out, const int w, cons
 //! \param[in] w            Chiều rộng ảnh (image width)
 //! \param[in] h            Chiều cao ảnh (image height)
 //! \param[in] r            Bán kính box blur (box radius/dimension)
+//! \param[in] prefetch     Số byte đầu của hàng kế tiếp cần prefetch (0: tắt, xem prefetch_next_row)
 //!
 //! \todo Rework this one at some point.
 template<typename T, int C, Kernel kernel = kSmall>
-inline void horizontal_blur_mirror(const T* in, T* out, const int w, const int h, const int r)
+inline void horizontal_blur_mirror(const T* in, T* out, const int w, const int h, const int r, const int prefetch = 0)
 {
     // Thay đổi kiểu biến local dựa trên kiểu template để tính toán nhanh hơn
     using calc_type = std::conditional_t<std::is_integral_v<T>, int, float>;
@@ -572,15 +878,12 @@ inline void horizontal_blur_mirror(const T* in, T* out, const int w, const int h
     // Tính nghịch đảo kích thước kernel để chuẩn hóa kết quả
     const double iarr = 1.f/(r+r+1);
     
-    // ================================================================
-    // SONG SONG HÓA: Mỗi hàng được xử lý song song bởi các threads khác nhau
-    // Thread pool được quản lý tự động bởi OpenMP runtime
-    // ================================================================
-    OMP_PARALLEL_FOR
+    // Duyệt tuần tự các hàng của dải được giao (song song hóa ở caller, xem horizontal_blur_extend)
     for (int i = 0; i < h; i++)  // Duyệt qua từng hàng của ảnh
     {
         const int begin = i*w;
         const int end = begin+w;
+        prefetch_next_row<T,C>(in, w, h, i, prefetch);
         calc_type acc[C] = { 0 };
 
         // current index, left index, right index
@@ -710,10 +1013,11 @@ inline void horizontal_blur_mirror(const T* in, T* out, const int w, const int h
 //! \param[in] w            Chiều rộng ảnh (image width)
 //! \param[in] h            Chiều cao ảnh (image height)
 //! \param[in] r            Bán kính box blur (box radius/dimension)
+//! \param[in] prefetch     Số byte đầu của hàng kế tiếp cần prefetch (0: tắt, xem prefetch_next_row)
 //!
 //! \todo Make a faster version for small kernels.
 template<typename T, int C>
-inline void horizontal_blur_wrap(const T* in, T* out, const int w, const int h, const int r)
+inline void horizontal_blur_wrap(const T* in, T* out, const int w, const int h, const int r, const int prefetch = 0)
 {
     // Thay đổi kiểu biến local dựa trên kiểu template để tính toán nhanh hơn
     using calc_type = std::conditional_t<std::is_integral_v<T>, int, float>;
@@ -721,16 +1025,12 @@ inline void horizontal_blur_wrap(const T* in, T* out, const int w, const int h,
     // Tính nghịch đảo kích thước kernel để chuẩn hóa kết quả
     const float iarr = 1.f / (r+r+1);
     
-    // ================================================================
-    // SONG SONG HÓA: Xử lý song song các hàng của ảnh
-    // Mỗi thread xử lý một tập hợp hàng độc lập, không có race condition
-    // vì mỗi hàng được ghi vào vùng nhớ riêng biệt
-    // ================================================================
-    OMP_PARALLEL_FOR
+    // Duyệt tuần tự các hàng của dải được giao (song song hóa ở caller, xem horizontal_blur_extend)
     for(int i=0; i<h; i++)  // Duyệt qua từng hàng của ảnh 
     {
         const int begin = i*w;
         const int end = begin+w;
+        prefetch_next_row<T,C>(in, w, h, i, prefetch);
         int ti = begin, li = begin-r-1, ri = begin+r;   // current index, left index, right index
         calc_type acc[C] = { 0 };                       // sliding accumulator
 
@@ -754,49 +1054,173 @@ inline void horizontal_blur_wrap(const T* in, T* out, const int w, const int h,
     }
 }
 
+//!
+//! \brief Box blur ngang với extended box (Gwosdek et al.): box bán kính r cộng thêm hai tap ở khoảng
+//! cách r+1 có trọng số alpha trong [0, 1), chuẩn hóa bởi 2r+1+2*alpha. Độ rộng box vì vậy thay đổi
+//! liên tục thay vì theo bước 2 pixel, và chuỗi pass đạt đúng sigma yêu cầu (xem sigma_to_extended_box).
+//! Vẫn là cửa sổ trượt O(1) mỗi pixel: tap đầu trái là pixel vừa rời cửa sổ, tap đầu phải là pixel
+//! sắp vào. Pixel ngoài hàng được ánh xạ bằng remap_index<P>; với kKernelCrop các tap ngoài ảnh
+//! bị bỏ và trọng số chuẩn hóa chỉ gồm các tap trong ảnh.
+//! Với step > 1 cửa sổ vẫn trượt qua mọi pixel nhưng chỉ pixel 0, step, 2*step... của hàng được tính
+//! và ghi: hàng đích dài (w+step-1)/step (blur kết hợp lấy mẫu thưa, xem fast_gaussian_blur_decimate).
+//!
+//! \param[in] in           Buffer ảnh nguồn (source buffer)
+//! \param[in,out] out      Buffer ảnh đích (target buffer), h hàng dài (w+step-1)/step
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] r            Bán kính phần nguyên của box
+//! \param[in] alpha        Trọng số của hai tap đầu, 0 <= alpha < 1
+//! \param[in] prefetch     Số byte đầu của hàng kế tiếp cần prefetch (0: tắt, xem prefetch_next_row)
+//! \param[in] step         Chỉ ghi mỗi pixel thứ step (mặc định 1: mọi pixel)
+//!
+template<typename T, int C, Border P>
+inline void horizontal_blur_extended(const T * in, T * out, const int w, const int h, const int r, const float alpha, const int prefetch = 0, const int step = 1)
+{
+    using calc_type = std::conditional_t<std::is_integral_v<T>, int, float>;
+    const float inorm = 1.f / (r+r+1+2*alpha);
+
+    const int ow = (w + step-1)/step;
+
+    for(int i=0; i<h; i++)
+    {
+        const int begin = i*w;
+        const int end = begin+w;
+        prefetch_next_row<T,C>(in, w, h, i, prefetch);
+        calc_type acc[C] = { 0 };   // tổng của phần nguyên [ti-r, ti+r]
+        T * target = out + std::size_t(i)*ow*C;
+        int next = begin;           // pixel kế tiếp cần ghi, vào target[written]
+        int written = 0;
+
+        // Pixel j của hàng theo border policy (0 ngoài ảnh với kKernelCrop)
+        auto remapped = [&](const int j, const int ch) -> calc_type
+        {
+            if constexpr(P == kKernelCrop)
+                return j >= begin && j < end ? calc_type(in[j*C+ch]) : calc_type(0);
+            else
+                return in[remap_index<P>(begin, end, j)*C+ch];
+        };
+        auto direct = [&](const int j, const int ch) -> calc_type { return in[j*C+ch]; };
+
+        // Trọng số chuẩn hóa của pixel ti: với kKernelCrop chỉ gồm các tap nằm trong ảnh
+        auto norm_at = [&](const int ti) -> float
+        {
+            if constexpr(P == kKernelCrop)
+            {
+                const int inside = std::min(end-1, ti+r) - std::max(begin, ti-r) + 1;
+                return 1.f / (inside + alpha*((ti-r-1 >= begin) + (ti+r+1 < end)));
+            }
+            return inorm;
+        };
+
+        // Trượt cửa sổ sang ti và ghi pixel ti nếu đến lượt
+        auto filter = [&](const int ti, auto tap, const float norm)
+        {
+            calc_type left[C];
+            for(int ch=0; ch<C; ++ch)
+            {
+                left[ch] = tap(ti-r-1, ch);
+                acc[ch] += tap(ti+r, ch) - left[ch];
+            }
+            if( ti != next )
+                return;
+            for(int ch=0; ch<C; ++ch)
+                target[written*C+ch] = (acc[ch] + alpha*(left[ch] + tap(ti+r+1, ch)))*norm + round_v<T>();
+            next += step;
+            ++written;
+        };
+
+        // initial accumulation: cửa sổ của pixel begin-1
+        for(int j=begin-r-1; j<begin+r; j++)
+        for(int ch=0; ch<C; ++ch)
+            acc[ch] += remapped(j, ch);
+
+        // Giữa hàng cả hai tap đầu nằm trong ảnh: truy cập trực tiếp, không ánh xạ
+        const int mid0 = std::min(end, begin+r+1), mid1 = std::max(mid0, end-r-1);
+        int ti = begin;
+        for(; ti<mid0; ti++)    filter(ti, remapped, norm_at(ti));
+        for(; ti<mid1; ti++)    filter(ti, direct, inorm);
+        for(; ti<end; ti++)     filter(ti, remapped, norm_at(ti));
+    }
+}
+
 //!
 //! \brief Hàm dispatcher template cho horizontal_blur.
 //! Template hóa theo kiểu dữ liệu buffer T, số kênh màu C, và border policy P.
 //! Hàm này tự động chọn phiên bản tối ưu dựa trên border policy và kích thước kernel.
+//! Chạy tuần tự trên h hàng (in/out có thể trỏ vào đầu một dải hàng của ảnh lớn hơn).
 //!
 //! \param[in] in           Buffer ảnh nguồn (source buffer)
 //! \param[in,out] out      Buffer ảnh đích (target buffer)
 //! \param[in] w            Chiều rộng ảnh (image width)
-//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] h            Số hàng cần xử lý (image/band height)
 //! \param[in] r            Bán kính box blur (box dimension/radius)
+//! \param[in] alpha        Trọng số tap đầu của extended box; 0 = box nguyên (sigma_to_boxes)
 //!
 template<typename T, int C, Border P = kMirror>
-inline void horizontal_blur(const T * in, T * out, const int w, const int h, const int r)
+inline void horizontal_blur_rows(const T * in, T * out, const int w, const int h, const int r, const float alpha = 0.f)
 {
+    const int prefetch = blur_plan().prefetch_row_bytes;
+
+    // Extended box: một kernel generic cho mọi border policy và kích thước kernel
+    if( alpha > 0.f )
+    {
+        horizontal_blur_extended<T,C,P>(in, out, w, h, r, alpha, prefetch);
+        return;
+    }
+
     // Dispatch theo border policy (compile-time) và kích thước kernel (runtime)
     if constexpr(P == kExtend)  // Chính sách Extend
     {
         // Chọn phiên bản tối ưu dựa trên kích thước kernel so với chiều rộng ảnh
-        if( r < w/2 )       horizontal_blur_extend<T,C,Kernel::kSmall>(in, out, w, h, r);  // Kernel nhỏ
-        else if( r < w )    horizontal_blur_extend<T,C,Kernel::kMid  >(in, out, w, h, r);  // Kernel trung bình
-        else                horizontal_blur_extend<T,C,Kernel::kLarge>(in, out, w, h, r);  // Kernel lớn
+        if( r < w/2 )       horizontal_blur_extend<T,C,Kernel::kSmall>(in, out, w, h, r, prefetch);  // Kernel nhỏ
+        else if( r < w )    horizontal_blur_extend<T,C,Kernel::kMid  >(in, out, w, h, r, prefetch);  // Kernel trung bình
+        else                horizontal_blur_extend<T,C,Kernel::kLarge>(in, out, w, h, r, prefetch);  // Kernel lớn
     }
     else if constexpr(P == kKernelCrop)  // Chính sách Kernel Crop
     {
-        if( r < w/2 )       horizontal_blur_kernel_crop<T,C,Kernel::kSmall>(in, out, w, h, r);
-        else if( r < w )    horizontal_blur_kernel_crop<T,C,Kernel::kMid  >(in, out, w, h, r);
-        else                horizontal_blur_kernel_crop<T,C,Kernel::kLarge>(in, out, w, h, r);
+        if( r < w/2 )       horizontal_blur_kernel_crop<T,C,Kernel::kSmall>(in, out, w, h, r, prefetch);
+        else if( r < w )    horizontal_blur_kernel_crop<T,C,Kernel::kMid  >(in, out, w, h, r, prefetch);
+        else                horizontal_blur_kernel_crop<T,C,Kernel::kLarge>(in, out, w, h, r, prefetch);
     }
     else if constexpr(P == kMirror)  // Chính sách Mirror
     {
-        if( r < w/2 )       horizontal_blur_mirror<T,C,Kernel::kSmall>(in, out, w, h, r);
-        else if( r < w )    horizontal_blur_mirror<T,C,Kernel::kMid  >(in, out, w, h, r);
-        else                horizontal_blur_mirror<T,C,Kernel::kLarge>(in, out, w, h, r);
+        if( r < w/2 )       horizontal_blur_mirror<T,C,Kernel::kSmall>(in, out, w, h, r, prefetch);
+        else if( r < w )    horizontal_blur_mirror<T,C,Kernel::kMid  >(in, out, w, h, r, prefetch);
+        else                horizontal_blur_mirror<T,C,Kernel::kLarge>(in, out, w, h, r, prefetch);
     }
     else if constexpr(P == kWrap)  // Chính sách Wrap (chỉ có 1 phiên bản generic)
     {
-        horizontal_blur_wrap<T,C>(in, out, w, h, r);
+        horizontal_blur_wrap<T,C>(in, out, w, h, r, prefetch);
     }
 }
 
 //!
-//! \brief Hàm dispatcher template cho horizontal_blur. Template hóa theo kiểu dữ liệu T và border policy P.
+//! \brief Phần việc của thread hiện tại trong một horizontal pass: dải hàng [t*h/n, (t+1)*h/n).
+//! Phải được gọi bởi mọi thread của vùng song song đang mở; không có barrier ở cuối. Thread t
+//! nhận cùng dải ở mọi pass có cùng h, nên các pass liên tiếp không cần đồng bộ với nhau.
+//! Gọi ngoài vùng song song thì xử lý toàn bộ ảnh.
+//!
+template<typename T, int C, Border P = kMirror>
+inline void horizontal_blur_team(const T * in, T * out, const int w, const int h, const int r, const float alpha = 0.f)
+{
+    const int t = omp_thread_index(), n = omp_thread_total();
+    const int y0 = int((long long)h*t/n), y1 = int((long long)h*(t+1)/n);
+    const std::size_t offset = std::size_t(y0)*w*C;
+    horizontal_blur_rows<T,C,P>(in + offset, out + offset, w, y1-y0, r, alpha);
+}
+
+//! Một horizontal pass độc lập: mở vùng song song riêng quanh horizontal_blur_team
+template<typename T, int C, Border P = kMirror>
+inline void horizontal_blur(const T * in, T * out, const int w, const int h, const int r)
+{
+    OMP_PARALLEL
+    horizontal_blur_team<T,C,P>(in, out, w, h, r);
+}
+
+//!
+//! \brief Hàm dispatcher template cho horizontal_blur_team. Template hóa theo kiểu dữ liệu T và border policy P.
 //! Hàm này dispatch theo số kênh màu c để gọi phiên bản template tối ưu tương ứng.
+//! Phải được gọi bởi mọi thread của vùng song song đang mở (xem horizontal_blur_team<T,C,P>).
 //!
 //! \param[in] in           Buffer ảnh nguồn (source buffer)
 //! \param[in,out] out      Buffer ảnh đích (target buffer)
@@ -804,156 +1228,1213 @@ inline void horizontal_blur(const T * in, T * out, const int w, const int h, con
 //! \param[in] h            Chiều cao ảnh (image height)
 //! \param[in] c            Số kênh màu (image channels)
 //! \param[in] r            Bán kính box blur (box dimension/radius)
+//! \param[in] alpha        Trọng số tap đầu của extended box; 0 = box nguyên
 //!
 template<typename T, Border P = kMirror>
-inline void horizontal_blur(const T * in, T * out, const int w, const int h, const int c, const int r)
+inline void horizontal_blur_team(const T * in, T * out, const int w, const int h, const int c, const int r, const float alpha = 0.f)
 {
     // Dispatch theo số kênh màu để gọi phiên bản template tối ưu
     // Việc này giúp compiler có thể unroll loops và optimize tốt hơn
     switch(c)
     {
-        case 1: horizontal_blur<T,1,P>(in, out, w, h, r); break;  // Grayscale
-        case 2: horizontal_blur<T,2,P>(in, out, w, h, r); break;  // 2 channels
-        case 3: horizontal_blur<T,3,P>(in, out, w, h, r); break;  // RGB
-        case 4: horizontal_blur<T,4,P>(in, out, w, h, r); break;  // RGBA
-        default: printf("horizontal_blur over %d channels is not supported yet. Add a specific case if possible or fall back to the generic version.\n", c); break;
-        // default: horizontal_blur<T>(in, out, w, h, c, r); break;
+        case 1: horizontal_blur_team<T,1,P>(in, out, w, h, r, alpha); break;  // Grayscale
+        case 2: horizontal_blur_team<T,2,P>(in, out, w, h, r, alpha); break;  // 2 channels
+        case 3: horizontal_blur_team<T,3,P>(in, out, w, h, r, alpha); break;  // RGB
+        case 4: horizontal_blur_team<T,4,P>(in, out, w, h, r, alpha); break;  // RGBA
+        default:
+            if( omp_thread_index() == 0 )
+                printf("horizontal_blur over %d channels is not supported yet. Add a specific case if possible or fall back to the generic version.\n", c);
+            break;
+        // default: horizontal_blur_team<T>(in, out, w, h, c, r); break;
     }
 }
 
+//! Một horizontal pass độc lập theo số kênh màu c (mở vùng song song riêng)
+template<typename T, Border P = kMirror>
+inline void horizontal_blur(const T * in, T * out, const int w, const int h, const int c, const int r)
+{
+    OMP_PARALLEL
+    horizontal_blur_team<T,P>(in, out, w, h, c, r);
+}
+
+//! Ngân sách (byte) của một dải cột trong vertical_blur_strip: mỗi bước đọc/ghi các đoạn hàng dài
+//! tối đa chừng này byte, đủ dài để mỗi lần chạm một trang nhớ (hàng cách nhau w*C phần tử) được
+//! dùng cho nhiều cache line, trong khi bộ tích lũy của dải vẫn nằm trong L1
+constexpr int kStripBytes = 1024;
+
 //!
-//! \brief Hàm này thực hiện chuyển vị (transpose) 2D của ảnh.
-//! Việc chuyển vị được thực hiện theo từng khối (block) để giảm số lần cache miss 
-//! và cải thiện cache coherency cho các buffer ảnh lớn.
-//! 
-//! Cache coherency: Thay vì transpose toàn bộ ảnh một lúc (gây nhiều cache miss),
-//! ta chia ảnh thành các block nhỏ và transpose từng block, giữ dữ liệu trong cache.
-//!
-//! Hàm được template hóa theo kiểu dữ liệu buffer T và số kênh màu C.
+//! \brief Box blur theo chiều dọc trực tiếp trên ảnh row-major, không chuyển vị: dải cột [x0, x1)
+//! được xử lý với một bộ tích lũy trượt cho mỗi phần tử của dải. Mỗi bước cộng hàng vào cửa sổ và
+//! trừ hàng rời cửa sổ, đều là các đoạn liên tục nên vòng lặp trong được vector hóa theo chiều ngang.
+//! Border policy (theo chỉ số hàng) và trọng số alpha của extended box giống horizontal_blur_extended;
+//! với alpha = 0 kết quả trùng với horizontal pass trên ảnh chuyển vị.
 //!
-//! \param[in] in           Buffer ảnh nguồn (source buffer) - dạng row-major
-//! \param[in,out] out      Buffer ảnh đích (target buffer) - sẽ chứa ảnh đã transpose (column-major)
-//! \param[in] w            Chiều rộng ảnh gốc (image width) - trở thành chiều cao sau transpose
-//! \param[in] h            Chiều cao ảnh gốc (image height) - trở thành chiều rộng sau transpose
+//! \param[in] in           Buffer ảnh nguồn (source buffer)
+//! \param[in,out] out      Buffer ảnh đích (target buffer)
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] x0, x1       Dải cột [x0, x1), tối đa kStripBytes/(sizeof(T)*C) cột
+//! \param[in] r            Bán kính box blur (box radius)
+//! \param[in] alpha        Trọng số tap đầu của extended box; 0 = box nguyên
 //!
-template<typename T, int C>
-inline void flip_block(const T * in, T * out, const int w, const int h)
+template<typename T, int C, Border P>
+inline void vertical_blur_strip(const T * in, T * out, const int w, const int h, const int x0, const int x1, const int r, const float alpha)
 {
-    // Kích thước block để transpose: 256/C pixels
-    // Block size được chọn để vừa với cache L1 (thường ~32KB)
-    // Chia cho C vì mỗi pixel có C channels
-    constexpr int block = 256/C;
-    
-    // ================================================================
-    // PHẦN SONG SONG HÓA (PARALLELIZATION) - CHI TIẾT:
-    // ================================================================
-    // #pragma omp parallel for collapse(2): Song song hóa 2 vòng lặp lồng nhau
-    //
-    // Cách hoạt động của collapse(2):
-    // 1. OpenMP sẽ "làm phẳng" 2 vòng lặp lồng nhau thành 1 vòng lặp lớn
-    // 2. Sau đó chia đều các iteration cho các threads
-    // 3. Ví dụ: w=1000, h=800, block=256
-    //    - Vòng lặp ngoài: x = 0, 256, 512, 768 (4 iterations)
-    //    - Vòng lặp trong: y = 0, 256, 512, 768 (4 iterations)
-    //    - Tổng: 4*4 = 16 iterations (block combinations)
-    //    - Với 4 threads, mỗi thread xử lý ~4 block combinations
-    //
-    // Tại sao dùng collapse(2):
-    // - Nếu chỉ parallelize vòng lặp ngoài, có thể không đủ work cho nhiều threads
-    // - Collapse(2) tạo nhiều tasks hơn, load balancing tốt hơn
-    // - Đặc biệt hiệu quả khi số blocks theo một chiều nhỏ
-    //
-    // Lợi ích của song song hóa transpose:
-    // - Transpose là operation tốn kém (O(w*h)), song song hóa tăng tốc đáng kể
-    // - Mỗi block được xử lý độc lập, không có race condition
-    // - Block-based approach giữ cache locality tốt
-    //
-    // Lưu ý: Cần compile với -fopenmp và link với OpenMP library
-    // ================================================================
-    OMP_PARALLEL_FOR_COLLAPSE_2
-    for(int x= 0; x < w; x+= block)     // Duyệt theo block theo chiều ngang
-    for(int y= 0; y < h; y+= block)     // Duyệt theo block theo chiều dọc
-    {
-        // Tính con trỏ bắt đầu của block trong buffer nguồn (in) và buffer đích (out)
-        // in: row-major format - pixel tại (y, x) = in[y*w*C + x*C]
-        const T * p = in + y*w*C + x*C;
-        // out: column-major format (sau transpose) - pixel tại (x, y) = out[y*C + x*h*C]
-        T * q = out + y*C + x*h*C;
-        
-        // Tính kích thước thực tế của block (có thể nhỏ hơn block size ở biên)
-        const int blockx= std::min(w, x+block) - x;  // Chiều rộng block (theo x)
-        const int blocky= std::min(h, y+block) - y;  // Chiều cao block (theo y)
-        
-        // Transpose block: copy từng pixel từ row-major sang column-major
-        for(int xx= 0; xx < blockx; xx++)  // Duyệt theo chiều ngang trong block
+    using calc_type = std::conditional_t<std::is_integral_v<T>, int, float>;
+    constexpr int kElements = kStripBytes / sizeof(T);
+    static const T zeros[kElements] = {};   // hàng ngoài ảnh của kKernelCrop
+
+    const int n = (x1-x0)*C;
+    const std::size_t stride = std::size_t(w)*C;
+    const float inorm = 1.f / (r+r+1+2*alpha);
+    calc_type acc[kElements] = { 0 };
+
+    // Đoạn của dải trên hàng y theo border policy
+    auto row = [&](const int y) -> const T *
+    {
+        if constexpr(P == kKernelCrop)
+            return y >= 0 && y < h ? in + y*stride + x0*C : zeros;
+        else
+            return in + (h > 1 ? remap_index<P>(0, h, y) : 0)*stride + x0*C;
+    };
+
+    // initial accumulation: cửa sổ của hàng -1
+    for(int y=-r-1; y<r; y++)
+    {
+        const T * src = row(y);
+        for(int k=0; k<n; k++)
+            acc[k] += src[k];
+    }
+
+    for(int ti=0; ti<h; ti++)
+    {
+        const T * left = row(ti-r-1);
+        const T * right = row(ti+r);
+        T * dst = out + ti*stride + x0*C;
+
+        float norm = inorm;
+        if constexpr(P == kKernelCrop)
+        {
+            const int inside = std::min(h-1, ti+r) - std::max(0, ti-r) + 1;
+            norm = 1.f / (inside + alpha*((ti-r-1 >= 0) + (ti+r+1 < h)));
+        }
+
+        if( alpha > 0.f )
+        {
+            const T * next = row(ti+r+1);
+            for(int k=0; k<n; k++)
+            {
+                acc[k] += right[k] - left[k];
+                dst[k] = (acc[k] + alpha*(left[k] + next[k]))*norm + round_v<T>();
+            }
+        }
+        else
         {
-            for(int yy= 0; yy < blocky; yy++)  // Duyệt theo chiều dọc trong block
+            for(int k=0; k<n; k++)
             {
-                // Copy tất cả channels của pixel hiện tại
-                for(int k= 0; k < C; k++)
-                    q[k]= p[k];
-                // Di chuyển con trỏ: p sang hàng tiếp theo trong ảnh gốc
-                p+= w*C;
-                // Di chuyển con trỏ: q sang cột tiếp theo trong ảnh đã transpose
-                q+= C;
+                acc[k] += right[k] - left[k];
+                dst[k] = acc[k]*norm + round_v<T>();
             }
-            // Sau khi copy xong một cột trong block, di chuyển sang cột tiếp theo
-            // Quay lại đầu cột và di chuyển sang cột kế
-            p+= -blocky*w*C + C;  // Quay lại đầu cột hiện tại, di chuyển sang pixel tiếp theo trong hàng
-            q+= -blocky*C + h*C;  // Quay lại đầu cột hiện tại trong output, di chuyển sang cột tiếp theo
         }
     }
 }
+
 //!
-//! \brief Hàm dispatcher template cho flip_block. Template hóa theo kiểu dữ liệu buffer T.
-//! Hàm này chọn phiên bản flip_block phù hợp dựa trên số kênh màu c.
-//! Việc dùng switch case giúp compiler optimize tốt hơn so với template đệ quy.
+//! \brief Hàm này chuyển vị (transpose) scalar một vùng chữ nhật [x0,x1) x [y0,y1) của ảnh.
+//! Dùng cho phần dư ở biên block, nơi không đủ chỗ cho một tile SIMD trọn vẹn.
 //!
-//! \param[in] in           Buffer ảnh nguồn (source buffer)
-//! \param[in,out] out      Buffer ảnh đích (target buffer)
-//! \param[in] w            Chiều rộng ảnh (image width)
-//! \param[in] h            Chiều cao ảnh (image height)
-//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] in           Buffer ảnh nguồn (source buffer) - dạng row-major
+//! \param[in,out] out      Buffer ảnh đích (target buffer) - ảnh đã transpose
+//! \param[in] w            Chiều rộng ảnh gốc (image width)
+//! \param[in] h            Chiều cao ảnh gốc (image height)
+//! \param[in] x0, x1       Dải cột nguồn cần chuyển vị [x0, x1)
+//! \param[in] y0, y1       Dải hàng nguồn cần chuyển vị [y0, y1)
 //!
-template<typename T>
-inline void flip_block(const T * in, T * out, const int w, const int h, const int c)
+template<typename T, int C>
+inline void flip_region(const T * in, T * out, const int w, const int h, const int x0, const int x1, const int y0, const int y1)
 {
-    // Dispatch theo số kênh màu để gọi phiên bản template tối ưu tương ứng
-    switch(c)
+    for(int x= x0; x < x1; x++)        // Duyệt theo chiều ngang trong vùng
     {
-        case 1: flip_block<T,1>(in, out, w, h); break;  // Grayscale (1 channel)
-        case 2: flip_block<T,2>(in, out, w, h); break;  // 2 channels (ví dụ: grayscale + alpha)
-        case 3: flip_block<T,3>(in, out, w, h); break;  // RGB (3 channels)
-        case 4: flip_block<T,4>(in, out, w, h); break;  // RGBA (4 channels)
-        default: printf("flip_block over %d channels is not supported yet. Add a specific case if possible or fall back to the generic version.\n", c); break;
-        // default: flip_block<T>(in, out, w, h, c); break;
+        const T * p = in + y0*w*C + x*C;
+        T * q = out + y0*C + x*h*C;
+        for(int y= y0; y < y1; y++)    // Duyệt theo chiều dọc trong vùng
+        {
+            // Copy tất cả channels của pixel hiện tại
+            for(int k= 0; k < C; k++)
+                q[k]= p[k];
+            p+= w*C;    // p sang hàng tiếp theo trong ảnh gốc
+            q+= C;      // q sang pixel tiếp theo trong ảnh đã transpose
+        }
     }
 }
 
 //!
-//! \brief Hàm này chuyển đổi độ lệch chuẩn (standard deviation) của Gaussian blur 
-//! thành bán kính box (box radius) cho mỗi lần box blur pass.
-//! Trả về giá trị sigma xấp xỉ đạt được với N lần box blur passes.
-//!
-//! Thuật toán dựa trên công thức từ paper của Peter Kovesi để xấp xỉ Gaussian blur
-//! bằng nhiều lần box blur. Việc sử dụng các box có kích thước khác nhau giúp
-//! xấp xỉ Gaussian tốt hơn so với dùng cùng một kích thước.
+//! \brief Chuyển vị một tile vuông K x K pixel ngay trong thanh ghi (register tile).
 //!
-//! Tài liệu tham khảo:
-//! - https://www.peterkovesi.com/papers/FastGaussianSmoothing.pdf
+//! Chuyển vị chỉ là di chuyển dữ liệu nên tile được định nghĩa theo số byte B của một pixel
+//! (B = sizeof(T)*C) thay vì theo kiểu T: uchar RGBA và float grayscale dùng chung một kernel.
+//! - B = 1, 2, 4, 8: SSE2 unpack, mỗi hàng tile con là một thanh ghi 128-bit (16/B pixel);
+//!   tile 16x16 cho uchar, 8x8 cho uchar 2 kênh/uint16, uchar RGBA/float và float 2 kênh
+//! - B = 16 (float RGBA): mỗi pixel là một thanh ghi, tile 8x8 chỉ là load/store 128-bit
+//! - Các B khác (3, 6, 12, ...): không có tile SIMD (simd = false), flip_block giữ cách copy scalar
 //!
-//! \param[out] boxes   Mảng chứa bán kính box cho mỗi pass (kernel sizes = 2*boxes[i]+1)
-//! \param[in] sigma    Độ lệch chuẩn Gaussian mong muốn
-//! \param[in] n        Số lần box blur passes
-//! \return             Giá trị sigma xấp xỉ đạt được
+//! \param[in] src          Con trỏ đến pixel góc trên-trái của tile nguồn
+//! \param[in] sstride      Khoảng cách (byte) giữa 2 hàng nguồn
+//! \param[out] dst         Con trỏ đến pixel góc trên-trái của tile đích
+//! \param[in] dstride      Khoảng cách (byte) giữa 2 hàng đích
 //!
-inline float sigma_to_box_radius(int boxes[], const float sigma, const int n)
+template<int B>
+struct flip_tile
 {
-    // Tính kích thước filter lý tưởng (ideal filter width) từ sigma và số passes
-    // Công thức: wi = sqrt(12*sigma^2/n + 1)
-    // Đây là kích thước box filter tối ưu để xấp xỉ Gaussian với n passes
-    float wi = std::sqrt((12*sigma*sigma/n)+1);
-    
+#if USE_SIMD
+    static constexpr bool simd = B == 1 || B == 2 || B == 4 || B == 8 || B == 16;
+#else
+    static constexpr bool simd = false;
+#endif
+    static constexpr int size = simd ? std::max(8, 16/B) : 1;   // K: số pixel mỗi cạnh tile
+
+#if USE_SIMD
+    static constexpr int lanes = 16/B;   // số pixel trong một thanh ghi 128-bit
+
+    static inline __m128i unpack_lo(const __m128i a, const __m128i b)
+    {
+        if constexpr(B == 1)        return _mm_unpacklo_epi8(a, b);
+        else if constexpr(B == 2)   return _mm_unpacklo_epi16(a, b);
+        else if constexpr(B == 4)   return _mm_unpacklo_epi32(a, b);
+        else                        return _mm_unpacklo_epi64(a, b);
+    }
+
+    static inline __m128i unpack_hi(const __m128i a, const __m128i b)
+    {
+        if constexpr(B == 1)        return _mm_unpackhi_epi8(a, b);
+        else if constexpr(B == 2)   return _mm_unpackhi_epi16(a, b);
+        else if constexpr(B == 4)   return _mm_unpackhi_epi32(a, b);
+        else                        return _mm_unpackhi_epi64(a, b);
+    }
+
+    //! Chuyển vị một tile con lanes x lanes: mỗi hàng là đúng một thanh ghi
+    static inline void apply_lanes(const uint8_t * src, const std::ptrdiff_t sstride, uint8_t * dst, const std::ptrdiff_t dstride)
+    {
+        constexpr int L = lanes;
+        __m128i x[L], t[L];
+        for(int i=0; i<L; ++i)
+            x[i] = _mm_loadu_si128((const __m128i *)(src + i*sstride));
+
+        // log2(L) vòng unpack, mỗi vòng ghép hàng i với hàng i+L/2:
+        // sau vòng cuối, thanh ghi j chứa cột j của tile nguồn
+        for(int round=1; round<L; round*=2)
+        {
+            for(int i=0; i<L/2; ++i)
+            {
+                t[2*i]   = unpack_lo(x[i], x[i+L/2]);
+                t[2*i+1] = unpack_hi(x[i], x[i+L/2]);
+            }
+            for(int i=0; i<L; ++i)
+                x[i] = t[i];
+        }
+
+        for(int j=0; j<L; ++j)
+            _mm_storeu_si128((__m128i *)(dst + j*dstride), x[j]);
+    }
+
+    static inline void apply(const uint8_t * src, const std::ptrdiff_t sstride, uint8_t * dst, const std::ptrdiff_t dstride)
+    {
+        // Tile K x K được ghép từ các tile con lanes x lanes (với B = 4, 8, 16) để mỗi hàng đích
+        // được ghi liên tục ít nhất 32 byte
+        constexpr int K = size, L = lanes;
+        for(int j=0; j<K; j+=L)
+        for(int i=0; i<K; i+=L)
+            apply_lanes(src + i*sstride + j*B, sstride, dst + j*dstride + i*B, dstride);
+    }
+#endif
+};
+
+//!
+//! \brief Prefetch K hàng nguồn của tile bắt đầu tại pixel (x, y) nếu tile đó còn nằm trong block
+//! (y + K <= yend). Các hàng cách nhau w*C phần tử nên hardware prefetcher thường không theo kịp.
+//!
+template<typename T, int C>
+inline void prefetch_flip_tile(const T * in, const int w, const int x, const int y, const int yend)
+{
+    constexpr int K = flip_tile<sizeof(T)*C>::size;
+    if( y + K > yend ) return;
+    for(int i = 0; i < K; ++i)
+    {
+        const char * p = (const char *)(in + (std::ptrdiff_t(y+i)*w + x)*C);
+        for(int b = 0; b < int(K*C*sizeof(T)); b += 64)
+            FGB_PREFETCH(p + b);
+    }
+}
+
+//!
+//! \brief Copy n byte bằng non-temporal store (movntdq): dữ liệu ghi thẳng ra RAM, không đi qua cache
+//! và không cần read-for-ownership. Phần đầu/cuối không căn lề 16 byte được ghi thông thường.
+//! Không có SIMD thì là memcpy.
+//!
+inline void stream_copy(uint8_t * dst, const uint8_t * src, std::size_t n)
+{
+#if USE_SIMD
+    for(; n > 0 && (reinterpret_cast<std::uintptr_t>(dst) & 15) != 0; --n)
+        *dst++ = *src++;
+    for(; n >= 16; n -= 16, dst += 16, src += 16)
+        _mm_stream_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+#endif
+    std::memcpy(dst, src, n);
+}
+
+//!
+//! \brief Hàm này chuyển vị tuần tự một vùng [x0,x1) x [y0,y1) của ảnh theo các block trong
+//! (inner) kích thước `inner` pixel; bên trong mỗi block, dữ liệu được chuyển vị theo tile K x K
+//! trong thanh ghi (xem flip_tile), phần dư ở biên block được xử lý scalar bởi flip_region.
+//!
+//! \param[in] in           Buffer ảnh nguồn (source buffer) - dạng row-major
+//! \param[in,out] out      Buffer ảnh đích (target buffer) - ảnh đã transpose
+//! \param[in] w            Chiều rộng ảnh gốc (image width)
+//! \param[in] h            Chiều cao ảnh gốc (image height)
+//! \param[in] x0, x1       Dải cột nguồn cần chuyển vị [x0, x1)
+//! \param[in] y0, y1       Dải hàng nguồn cần chuyển vị [y0, y1)
+//! \param[in] inner        Cạnh block trong (pixel), bội số của flip_tile<sizeof(T)*C>::size
+//! \param[in] prefetch     Khoảng cách prefetch (số tile theo chiều dọc) cho hàng nguồn, 0: tắt
+//!
+//! Với Stream = true, mỗi nhóm K hàng đích được chuyển vị vào bộ đệm tạm rồi ghi bằng
+//! non-temporal store (stream_copy); vùng kết thúc bằng sfence để các thread khác thấy dữ liệu.
+//!
+template<typename T, int C, bool Stream = false>
+inline void flip_block_region(const T * in, T * out, const int w, const int h, const int x0, const int x1, const int y0, const int y1, const int inner, const int prefetch = 0)
+{
+    using tile = flip_tile<sizeof(T)*C>;
+    constexpr int K = tile::size;
+
+    // Khoảng cách (byte) giữa 2 hàng của ảnh nguồn và ảnh đích
+    const std::ptrdiff_t sstride = std::ptrdiff_t(w)*C*sizeof(T);
+    const std::ptrdiff_t dstride = std::ptrdiff_t(h)*C*sizeof(T);
+
+    for(int x= x0; x < x1; x+= inner)   // Duyệt theo block trong theo chiều ngang
+    for(int y= y0; y < y1; y+= inner)   // Duyệt theo block trong theo chiều dọc
+    {
+        // Tính kích thước thực tế của block (có thể nhỏ hơn block size ở biên)
+        const int blockx= std::min(x1, x+inner) - x;  // Chiều rộng block (theo x)
+        const int blocky= std::min(y1, y+inner) - y;  // Chiều cao block (theo y)
+
+        if constexpr(Stream)
+        {
+            // Non-temporal store chỉ hiệu quả khi ghi trọn cache line liên tục: với mỗi nhóm K hàng đích,
+            // chuyển vị vào bộ đệm tạm (nằm trong L1) rồi ghi từng hàng đích (blocky pixel liên tục)
+            // bằng stream_copy
+            const int rowbytes = blocky*C*sizeof(T);
+            thread_local std::vector<uint8_t> staging;
+            staging.resize(std::size_t(K)*rowbytes);
+
+            for(int xx= 0; xx < blockx; xx+= K)
+            {
+                const int rows = std::min(K, blockx-xx);
+                int done = 0;   // số pixel đầu mỗi hàng đích đã được chuyển vị theo tile
+                if constexpr(tile::simd)
+                {
+                    if( rows == K )
+                    {
+                        done = blocky/K*K;
+                        for(int yy= 0; yy < done; yy+= K)
+                        {
+                            prefetch_flip_tile<T,C>(in, w, x+xx, y+yy+prefetch*K, y+blocky);
+                            tile::apply((const uint8_t *)(in + (y+yy)*w*C + (x+xx)*C), sstride, staging.data() + yy*C*sizeof(T), rowbytes);
+                        }
+                    }
+                }
+                for(int r= 0; r < rows; r++)
+                for(int yy= done; yy < blocky; yy++)
+                    std::memcpy(staging.data() + r*rowbytes + yy*C*sizeof(T), in + (y+yy)*w*C + (x+xx+r)*C, C*sizeof(T));
+
+                for(int r= 0; r < rows; r++)
+                    stream_copy((uint8_t *)(out + (x+xx+r)*h*C + y*C), staging.data() + r*rowbytes, rowbytes);
+            }
+            continue;
+        }
+
+        if constexpr(tile::simd)
+        {
+            // Phần của block chia hết cho K: chuyển vị theo tile trong thanh ghi
+            const int tilex= blockx/K*K;
+            const int tiley= blocky/K*K;
+            for(int xx= 0; xx < tilex; xx+= K)
+            for(int yy= 0; yy < tiley; yy+= K)
+            {
+                // in: row-major - pixel (y, x) = in[y*w*C + x*C]
+                // out: ảnh đã transpose - pixel (x, y) = out[x*h*C + y*C]
+                const T * p = in + (y+yy)*w*C + (x+xx)*C;
+                T * q = out + (x+xx)*h*C + (y+yy)*C;
+                prefetch_flip_tile<T,C>(in, w, x+xx, y+yy+prefetch*K, y+blocky);
+                tile::apply((const uint8_t *)p, sstride, (uint8_t *)q, dstride);
+            }
+
+            // Phần dư: dải bên phải (các cột không đủ một tile) và dải bên dưới (các hàng không đủ một tile)
+            flip_region<T,C>(in, out, w, h, x+tilex, x+blockx, y, y+blocky);
+            flip_region<T,C>(in, out, w, h, x, x+tilex, y+tiley, y+blocky);
+        }
+        else
+        {
+            // Pixel 3, 6, 12 byte: SSE2 không có shuffle hiệu quả cho các kích thước này,
+            // copy scalar theo block vẫn nhanh hơn một register tile
+            flip_region<T,C>(in, out, w, h, x, x+blockx, y, y+blocky);
+        }
+    }
+
+#if USE_SIMD
+    // Non-temporal store không tuân theo thứ tự ghi thông thường: sfence trước khi thread khác đọc
+    if constexpr(Stream)
+        _mm_sfence();
+#endif
+}
+//!
+//! \brief Hàm này thực hiện chuyển vị (transpose) 2D của ảnh.
+//! Việc chuyển vị được thực hiện theo từng khối (block) để giảm số lần cache miss 
+//! và cải thiện cache coherency cho các buffer ảnh lớn.
+//! 
+//! Cache coherency: Thay vì transpose toàn bộ ảnh một lúc (gây nhiều cache miss),
+//! ta chia ảnh thành các block nhỏ và transpose từng block, giữ dữ liệu trong cache.
+//! Bên trong mỗi block, dữ liệu được chuyển vị theo tile K x K trong thanh ghi (xem flip_tile),
+//! phần dư ở biên block được xử lý scalar bởi flip_region.
+//!
+//! Hàm được template hóa theo kiểu dữ liệu buffer T và số kênh màu C.
+//! Phải được gọi bởi mọi thread của vùng song song đang mở (worksharing mồ côi), và kết thúc
+//! bằng một barrier: sau khi trả về, toàn bộ ảnh chuyển vị đã sẵn sàng cho mọi thread.
+//!
+//! \param[in] in           Buffer ảnh nguồn (source buffer) - dạng row-major
+//! \param[in,out] out      Buffer ảnh đích (target buffer) - sẽ chứa ảnh đã transpose (column-major)
+//! \param[in] w            Chiều rộng ảnh gốc (image width) - trở thành chiều cao sau transpose
+//! \param[in] h            Chiều cao ảnh gốc (image height) - trở thành chiều rộng sau transpose
+//! \param[in] plan         Plan chứa ngân sách block chuyển vị (xem BlurPlan)
+//! \param[in] stream       Ghi kết quả bằng non-temporal store (cho output không được đọc lại ngay)
+//!
+template<typename T, int C>
+inline void flip_block_team(const T * in, T * out, const int w, const int h, const BlurPlan & plan, const bool stream = false)
+{
+    using tile = flip_tile<sizeof(T)*C>;
+    constexpr int K = tile::size;
+
+    // Kích thước block 2 mức (pixel), lấy từ plan theo kích thước cache của máy:
+    // - outer: đơn vị song song hóa, vừa với L2
+    // - inner: duyệt tuần tự trong outer, vừa với L1, là bội số của tile K
+    const int inner = BlurPlan::block_side(plan.flip_l1_bytes, sizeof(T)*C, K);
+    const int outer = std::max(inner, BlurPlan::block_side(plan.flip_l2_bytes, sizeof(T)*C, inner));
+
+    // Chế độ NUMA: mỗi thread ghi dải hàng đích [t*w/n, (t+1)*w/n) - phần [t/n, (t+1)/n) của buffer
+    // đích, trùng với phần thread đó đã first-touch và ghi trong các horizontal pass
+    if( plan.numa_bands )
+    {
+        const int t = omp_thread_index(), n = omp_thread_total();
+        const int xb = int((long long)w*t/n), xe = int((long long)w*(t+1)/n);
+        for(int x= xb; x < xe; x+= outer)
+        for(int y= 0; y < h; y+= outer)
+        {
+            if( stream )    flip_block_region<T,C,true >(in, out, w, h, x, std::min(xe, x+outer), y, std::min(h, y+outer), inner, plan.prefetch_flip_tiles);
+            else            flip_block_region<T,C,false>(in, out, w, h, x, std::min(xe, x+outer), y, std::min(h, y+outer), inner, plan.prefetch_flip_tiles);
+        }
+        OMP_BARRIER
+        return;
+    }
+
+    // ================================================================
+    // PHẦN SONG SONG HÓA (PARALLELIZATION) - CHI TIẾT:
+    // ================================================================
+    // #pragma omp for collapse(2): Song song hóa 2 vòng lặp lồng nhau trong team đang mở,
+    // barrier ngầm ở cuối vòng lặp đảm bảo ảnh chuyển vị hoàn chỉnh trước pass kế tiếp
+    //
+    // Cách hoạt động của collapse(2):
+    // 1. OpenMP sẽ "làm phẳng" 2 vòng lặp lồng nhau thành 1 vòng lặp lớn
+    // 2. Sau đó chia đều các iteration cho các threads
+    // 3. Ví dụ: w=1000, h=800, outer=256
+    //    - Vòng lặp ngoài: x = 0, 256, 512, 768 (4 iterations)
+    //    - Vòng lặp trong: y = 0, 256, 512, 768 (4 iterations)
+    //    - Tổng: 4*4 = 16 iterations (block combinations)
+    //    - Với 4 threads, mỗi thread xử lý ~4 block combinations
+    //
+    // Tại sao dùng collapse(2):
+    // - Nếu chỉ parallelize vòng lặp ngoài, có thể không đủ work cho nhiều threads
+    // - Collapse(2) tạo nhiều tasks hơn, load balancing tốt hơn
+    // - Đặc biệt hiệu quả khi số blocks theo một chiều nhỏ
+    //
+    // Lợi ích của song song hóa transpose:
+    // - Transpose là operation tốn kém (O(w*h)), song song hóa tăng tốc đáng kể
+    // - Mỗi block được xử lý độc lập, không có race condition
+    // - Block-based approach giữ cache locality tốt
+    //
+    // Lưu ý: Cần compile với -fopenmp và link với OpenMP library
+    // ================================================================
+    OMP_FOR_COLLAPSE_2
+    for(int x= 0; x < w; x+= outer)     // Duyệt theo block ngoài theo chiều ngang
+    for(int y= 0; y < h; y+= outer)     // Duyệt theo block ngoài theo chiều dọc
+    {
+        if( stream )    flip_block_region<T,C,true >(in, out, w, h, x, std::min(w, x+outer), y, std::min(h, y+outer), inner, plan.prefetch_flip_tiles);
+        else            flip_block_region<T,C,false>(in, out, w, h, x, std::min(w, x+outer), y, std::min(h, y+outer), inner, plan.prefetch_flip_tiles);
+    }
+}
+
+//! Một phép chuyển vị độc lập: mở vùng song song riêng quanh flip_block_team
+template<typename T, int C>
+inline void flip_block(const T * in, T * out, const int w, const int h, const BlurPlan & plan, const bool stream = false)
+{
+    OMP_PARALLEL
+    flip_block_team<T,C>(in, out, w, h, plan, stream);
+}
+
+//! Phiên bản dùng plan chung blur_plan()
+template<typename T, int C>
+inline void flip_block(const T * in, T * out, const int w, const int h, const bool stream = false)
+{
+    flip_block<T,C>(in, out, w, h, blur_plan(), stream);
+}
+
+//!
+//! \brief Dispatcher theo số kênh màu c cho flip_block_team, gọi bởi mọi thread của vùng song song
+//! đang mở (xem flip_block_team<T,C>).
+//!
+template<typename T>
+inline void flip_block_team(const T * in, T * out, const int w, const int h, const int c, const bool stream = false)
+{
+    const BlurPlan & plan = blur_plan();
+    switch(c)
+    {
+        case 1: flip_block_team<T,1>(in, out, w, h, plan, stream); break;
+        case 2: flip_block_team<T,2>(in, out, w, h, plan, stream); break;
+        case 3: flip_block_team<T,3>(in, out, w, h, plan, stream); break;
+        case 4: flip_block_team<T,4>(in, out, w, h, plan, stream); break;
+        default:
+            if( omp_thread_index() == 0 )
+                printf("flip_block over %d channels is not supported yet. Add a specific case if possible or fall back to the generic version.\n", c);
+            break;
+    }
+}
+
+//!
+//! \brief Hàm dispatcher template cho flip_block. Template hóa theo kiểu dữ liệu buffer T.
+//! Hàm này chọn phiên bản flip_block phù hợp dựa trên số kênh màu c.
+//! Việc dùng switch case giúp compiler optimize tốt hơn so với template đệ quy.
+//!
+//! \param[in] in           Buffer ảnh nguồn (source buffer)
+//! \param[in,out] out      Buffer ảnh đích (target buffer)
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] stream       Ghi kết quả bằng non-temporal store (mặc định: không)
+//!
+template<typename T>
+inline void flip_block(const T * in, T * out, const int w, const int h, const int c, const bool stream = false)
+{
+    // Dispatch theo số kênh màu để gọi phiên bản template tối ưu tương ứng
+    switch(c)
+    {
+        case 1: flip_block<T,1>(in, out, w, h, stream); break;  // Grayscale (1 channel)
+        case 2: flip_block<T,2>(in, out, w, h, stream); break;  // 2 channels (ví dụ: grayscale + alpha)
+        case 3: flip_block<T,3>(in, out, w, h, stream); break;  // RGB (3 channels)
+        case 4: flip_block<T,4>(in, out, w, h, stream); break;  // RGBA (4 channels)
+        default: printf("flip_block over %d channels is not supported yet. Add a specific case if possible or fall back to the generic version.\n", c); break;
+        // default: flip_block<T>(in, out, w, h, c); break;
+    }
+}
+
+//!
+//! \brief Chọn ngân sách block chuyển vị tốt nhất cho máy hiện tại bằng một benchmark nhỏ.
+//! Thử các tổ hợp (inner, outer) quanh kích thước L1/L2 trên ảnh uchar RGBA 2048x2048
+//! (16MB, lớn hơn LLC thông thường) và giữ tổ hợp nhanh nhất (best of 3 cho mỗi tổ hợp),
+//! sau đó chọn khoảng cách prefetch_flip_tiles với block đã chọn.
+//! Mất khoảng vài trăm ms; các tham số khác của plan được giữ nguyên.
+//!
+//! \param[in] base         Plan gốc
+//! \return                 Plan với flip_l1_bytes/flip_l2_bytes đã được tune
+//!
+inline BlurPlan autotune_blur_plan(const BlurPlan & base)
+{
+    const CacheInfo cache = detect_cache_info();
+    const int w = 2048, h = 2048;
+    std::vector<uint8_t> src(std::size_t(w)*h*4), dst(src.size());
+    for(std::size_t i = 0; i < src.size(); ++i)
+        src[i] = uint8_t(i*7);
+
+    BlurPlan best = base, trial = base;
+    double best_time = 1e30;
+    for(const int l1 : { cache.l1/4, cache.l1/2, cache.l1, cache.l1*2, cache.l1*4 })
+    for(const int l2 : { cache.l2/4, cache.l2/2, cache.l2, cache.l2*2 })
+    {
+        if( l2 < l1 ) continue;
+        trial.flip_l1_bytes = l1;
+        trial.flip_l2_bytes = l2;
+        double time = 1e30;
+        for(int run = 0; run < 3; ++run)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            flip_block<uint8_t,4>(src.data(), dst.data(), w, h, trial);
+            const auto end = std::chrono::steady_clock::now();
+            time = std::min(time, std::chrono::duration<double>(end - start).count());
+        }
+        if( time < best_time )
+        {
+            best_time = time;
+            best = trial;
+        }
+    }
+
+    // Khoảng cách prefetch cho chuyển vị, với block đã chọn
+    trial = best;
+    for(const int distance : { 0, 1, 2, 4 })
+    {
+        trial.prefetch_flip_tiles = distance;
+        double time = 1e30;
+        for(int run = 0; run < 3; ++run)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            flip_block<uint8_t,4>(src.data(), dst.data(), w, h, trial);
+            const auto end = std::chrono::steady_clock::now();
+            time = std::min(time, std::chrono::duration<double>(end - start).count());
+        }
+        if( time < best_time )
+        {
+            best_time = time;
+            best = trial;
+        }
+    }
+    return best;
+}
+
+//!
+//! \brief Tạo plan ban đầu: nạp từ FGB_PLAN_FILE nếu có, ngược lại suy ra từ kích thước cache,
+//! và chạy autotune (lưu kết quả vào FGB_PLAN_FILE) nếu FGB_AUTOTUNE=1.
+//!
+inline BlurPlan make_blur_plan()
+{
+    BlurPlan plan;
+    const CacheInfo cache = detect_cache_info();
+    plan.flip_l1_bytes = cache.l1*2;
+    plan.flip_l2_bytes = std::max(cache.l2/2, plan.flip_l1_bytes);
+    plan.band_bytes = std::max(cache.l2/4, 16*1024);
+
+    const char * file = std::getenv("FGB_PLAN_FILE");
+    if( file && load_blur_plan(plan, file) )
+        return plan;
+
+    const char * tune = std::getenv("FGB_AUTOTUNE");
+    if( tune && std::atoi(tune) != 0 )
+    {
+        plan = autotune_blur_plan(plan);
+        calibrate_cost_model(plan);
+        if( file ) save_blur_plan(plan, file);
+    }
+    return plan;
+}
+
+inline BlurPlan & blur_plan()
+{
+    static BlurPlan plan = make_blur_plan();
+    return plan;
+}
+
+// ================================================================
+// CẤP PHÁT BỘ NHỚ NUMA (FIRST-TOUCH) VÀ GẮN THREAD (PINNING)
+// ================================================================
+//
+// Trên máy nhiều socket, hệ điều hành đặt một trang nhớ lên node của thread ghi nó đầu tiên
+// (first-touch). Buffer cấp phát bằng new[] rồi được một thread copy vào sẽ nằm hết trên một node,
+// và một nửa số thread phải đọc bộ nhớ từ xa ở mọi pass. Các hàm dưới đây chạm (touch) buffer
+// song song với đúng cách chia schedule(static) của các pass: worker t chạm phần [t/n, (t+1)/n).
+// Chúng chạy qua run_workers trên backend đang chọn, để trang nhớ nằm trên node của chính các
+// thread (OpenMP, thread pool đã pin, executor) sẽ xử lý buffer.
+// Vì dải hàng của thread t trong ảnh gốc (h hàng) và trong ảnh chuyển vị (w hàng) đều là phần
+// [t/n, (t+1)/n) của buffer, cả hai hướng đều là bộ nhớ local (với BlurPlan::numa_bands).
+//
+
+//! Số worker của backend hiện tại, định nghĩa ở phần backend
+inline int worker_count();
+
+//! Chạy worker(i) cho i trong [0, count) trên backend hiện tại, định nghĩa ở phần backend
+template<typename F>
+inline void run_workers(const int count, F && worker);
+
+//! Kích thước trang nhớ của hệ thống (byte)
+inline std::size_t page_size()
+{
+#if defined(__linux__)
+    const long page = sysconf(_SC_PAGESIZE);
+    if( page > 0 ) return std::size_t(page);
+#endif
+    return 4096;
+}
+
+//!
+//! \brief Copy song song count phần tử, worker t copy phần [t/n, (t+1)/n): nếu dst chưa được chạm,
+//! các trang của dst nằm trên node của worker sẽ xử lý chúng.
+//!
+template<typename T>
+inline void first_touch_copy(T * dst, const T * src, const std::size_t count)
+{
+    const int n = worker_count();
+    run_workers(n, [&](const int t)
+    {
+        const std::size_t begin = count*t/n, end = count*(t+1)/n;
+        std::memcpy(dst + begin, src + begin, (end - begin)*sizeof(T));
+    });
+}
+
+//!
+//! \brief Cấp phát buffer count phần tử căn lề theo trang. Nếu touch = true, các trang được chạm
+//! song song (phần [t/n, (t+1)/n) bởi worker t); dùng touch = false nếu buffer sẽ được điền ngay
+//! bằng first_touch_copy. Giải phóng bằng first_touch_free.
+//!
+//! \return Con trỏ đến buffer, hoặc nullptr nếu không cấp phát được
+//!
+template<typename T>
+inline T * first_touch_alloc(const std::size_t count, const bool touch = true)
+{
+    const std::size_t page = page_size();
+    const std::size_t bytes = std::max<std::size_t>(1, (count*sizeof(T) + page-1)/page) * page;
+    void * ptr = nullptr;
+#if defined(_WIN32)
+    ptr = _aligned_malloc(bytes, page);
+#else
+    if( posix_memalign(&ptr, page, bytes) != 0 ) ptr = nullptr;
+#endif
+    if( ptr && touch )
+    {
+        uint8_t * bytes_ptr = (uint8_t *)ptr;
+        const long pages = long(bytes / page);
+        const int n = worker_count();
+        run_workers(n, [&](const int t)
+        {
+            for(long i = pages*t/n; i < pages*(t+1)/n; ++i)
+                bytes_ptr[i*page] = 0;
+        });
+    }
+    return (T *)ptr;
+}
+
+//! Giải phóng buffer cấp phát bởi first_touch_alloc
+template<typename T>
+inline void first_touch_free(T * ptr)
+{
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+//! Danh sách CPU mà process được phép chạy (rỗng nếu không xác định được)
+inline std::vector<int> allowed_cpus()
+{
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if( sched_getaffinity(0, sizeof(allowed), &allowed) == 0 )
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if( CPU_ISSET(cpu, &allowed) )
+                cpus.push_back(cpu);
+#endif
+    return cpus;
+}
+
+//! Gắn thread hiện tại vào CPU thứ slot*m/slots trong m CPU của cpus; trả về true nếu thành công
+inline bool pin_current_thread(const std::vector<int> & cpus, const int slot, const int slots)
+{
+#if defined(__linux__)
+    if( cpus.empty() || slots <= 0 )
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[std::size_t(slot)*cpus.size()/slots], &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus; (void)slot; (void)slots;
+    return false;
+#endif
+}
+
+//!
+//! \brief Gắn mỗi thread OpenMP vào một CPU cố định: thread t chạy trên CPU thứ t*m/n trong m CPU
+//! được phép, nên các thread liên tiếp (dải hàng liên tiếp) ở cùng node. Việc gắn tồn tại qua
+//! các vùng song song sau với cùng số thread. Tương đương OMP_PROC_BIND=spread OMP_PLACES=cores
+//! khi không thể đặt biến môi trường trước khi chương trình khởi động.
+//!
+//! \return true nếu mọi thread được gắn thành công (chỉ hỗ trợ Linux + OpenMP)
+//!
+inline bool pin_threads()
+{
+#if USE_OPENMP && defined(_OPENMP) && defined(__linux__)
+    const std::vector<int> cpus = allowed_cpus();
+    if( cpus.empty() )
+        return false;
+
+    int failures = 0;
+    #pragma omp parallel reduction(+:failures)
+    failures += !pin_current_thread(cpus, omp_thread_index(), omp_thread_total());
+    return failures == 0;
+#else
+    return false;
+#endif
+}
+
+// ================================================================
+// BACKEND ĐA LUỒNG (THREADING BACKEND)
+// ================================================================
+//
+// blur_graph không gọi OpenMP trực tiếp mà chạy các worker qua run_workers(), với backend chọn
+// lúc compile (macro FGB_BACKEND) hoặc lúc chạy (blur_backend(), biến môi trường FGB_BACKEND):
+// - kBackendOpenMP   : một vùng omp parallel (mặc định khi USE_OPENMP)
+// - kBackendPool     : thread pool tích hợp (BlurThreadPool), không cần OpenMP runtime
+// - kBackendExecutor : executor của ứng dụng (thread pool có sẵn của host), xem BlurExecutor
+// - kBackendSerial   : chạy trên thread gọi (mặc định khi không có OpenMP)
+// Vì các task của blur_graph được nhận theo thứ tự topo, backend không cần đảm bảo các worker
+// chạy đồng thời: executor chạy tuần tự từng worker vẫn cho kết quả đúng.
+//
+
+//! Các backend đa luồng
+enum Backend
+{
+    kBackendSerial,     // Tuần tự trên thread gọi
+    kBackendOpenMP,     // OpenMP (cần USE_OPENMP)
+    kBackendPool,       // Thread pool tích hợp
+    kBackendExecutor,   // Executor do ứng dụng cung cấp
+};
+
+// Backend mặc định lúc compile: định nghĩa FGB_BACKEND trước khi include header để thay đổi
+#ifndef FGB_BACKEND
+    #if USE_OPENMP && defined(_OPENMP)
+        #define FGB_BACKEND kBackendOpenMP
+    #else
+        #define FGB_BACKEND kBackendSerial
+    #endif
+#endif
+
+//!
+//! \brief Executor do ứng dụng cung cấp: phải gọi job(arg, i) đúng một lần cho mỗi i trong [0, count),
+//! theo bất kỳ thứ tự và mức song song nào, và chỉ trả về khi mọi lời gọi đã xong.
+//! user là con trỏ ngữ cảnh đăng ký cùng executor (ví dụ thread pool của host).
+//!
+typedef void (*BlurExecutor)(void * user, int count, void (*job)(void * arg, int index), void * arg);
+
+//! Cấu hình backend dùng chung (blur_backend())
+struct BlurBackend
+{
+    Backend kind = FGB_BACKEND;
+    int threads = 0;                    // số worker cho kBackendPool/kBackendExecutor (0: số CPU)
+    int spin_us = 50;                   // kBackendPool: thời gian worker spin chờ job mới trước khi ngủ (futex)
+    bool pin = false;                   // kBackendPool: gắn mỗi worker nền vào một CPU
+    BlurExecutor executor = nullptr;    // cho kBackendExecutor
+    void * user = nullptr;              // ngữ cảnh truyền lại cho executor
+};
+
+//! Cấu hình backend ban đầu: FGB_BACKEND=serial|openmp|pool, FGB_THREADS=<n>, FGB_SPIN_US=<us>
+//! và FGB_PIN=1 ghi đè mặc định
+inline BlurBackend make_blur_backend()
+{
+    BlurBackend backend;
+    if( const char * kind = std::getenv("FGB_BACKEND") )
+    {
+        if( std::strcmp(kind, "serial") == 0 )      backend.kind = kBackendSerial;
+        else if( std::strcmp(kind, "openmp") == 0 ) backend.kind = kBackendOpenMP;
+        else if( std::strcmp(kind, "pool") == 0 )   backend.kind = kBackendPool;
+    }
+    if( const char * threads = std::getenv("FGB_THREADS") )
+        backend.threads = std::max(0, std::atoi(threads));
+    if( const char * spin = std::getenv("FGB_SPIN_US") )
+        backend.spin_us = std::max(0, std::atoi(spin));
+    if( const char * pin = std::getenv("FGB_PIN") )
+        backend.pin = std::atoi(pin) != 0;
+    return backend;
+}
+
+//! Trả về cấu hình backend dùng chung (đổi trước lần blur đầu tiên, không đổi trong lúc blur)
+inline BlurBackend & blur_backend()
+{
+    static BlurBackend backend = make_blur_backend();
+    return backend;
+}
+
+//! Chuyển sang executor của ứng dụng với tối đa threads worker đồng thời
+inline void set_blur_executor(BlurExecutor executor, void * user, const int threads)
+{
+    BlurBackend & backend = blur_backend();
+    backend.kind = executor ? kBackendExecutor : FGB_BACKEND;
+    backend.executor = executor;
+    backend.user = user;
+    backend.threads = threads;
+}
+
+//! Số CPU của máy (ít nhất 1)
+inline int hardware_threads()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//!
+//! \brief Thread pool tích hợp với work stealing không khóa (lock-free).
+//!
+//! run(count, job, arg) chia [0, count) thành các dải liên tục, mỗi worker (kể cả thread gọi) một dải.
+//! Worker lấy chỉ số từ đầu dải của mình; khi hết, nó lấy trộm nửa sau dải của worker khác.
+//! Mỗi dải là một cặp [begin, end) gói trong một atomic 64 bit, cập nhật bằng CAS.
+//! run() không cấp phát bộ nhớ; các lời gọi run() đồng thời được xếp hàng.
+//!
+//! Đánh thức độ trễ thấp: job mới được công bố bằng cách tăng epoch. Worker rảnh spin trên epoch
+//! trong spin_us micro giây (đủ để bắt frame kế tiếp của luồng video mà không cần system call),
+//! sau đó ngủ bằng futex (Linux) hoặc condition variable. run() chỉ gọi system call đánh thức
+//! khi thực sự có worker đang ngủ.
+//!
+class BlurThreadPool
+{
+public:
+    //! \param[in] threads  Tổng số worker, tính cả thread gọi run() (threads-1 thread nền)
+    //! \param[in] spin_us  Thời gian spin chờ job trước khi ngủ (micro giây)
+    //! \param[in] pin      Gắn worker nền i vào CPU thứ i*m/threads trong m CPU được phép
+    BlurThreadPool(const int threads, const int spin_us = 50, const bool pin = false)
+    : workers(std::max(1, threads)), spin(spin_us), ranges(new Range[std::max(1, threads)])
+    {
+        const std::vector<int> cpus = pin ? allowed_cpus() : std::vector<int>();
+        for(int id = 1; id < workers; ++id)
+            threads_.emplace_back([this, id, cpus]
+            {
+                if( !cpus.empty() )
+                    pin_current_thread(cpus, id, workers);
+                worker_loop(id);
+            });
+    }
+
+    ~BlurThreadPool()
+    {
+        stop.store(true, std::memory_order_seq_cst);
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        wake_all();
+        for(std::thread & thread : threads_)
+            thread.join();
+    }
+
+    //! Tổng số worker (kể cả thread gọi)
+    int size() const { return workers; }
+
+    //! Gọi job(arg, i) cho mọi i trong [0, count) và chờ tất cả xong
+    void run(const int count, void (*job)(void *, int), void * arg)
+    {
+        // Gọi từ bên trong một worker của chính pool (blur lồng nhau): chạy tuần tự, không chờ pool
+        if( inside_pool() || workers == 1 || count <= 1 )
+        {
+            for(int i = 0; i < count; ++i)
+                job(arg, i);
+            return;
+        }
+
+        std::lock_guard<std::mutex> submit_lock(submit);
+        for(int id = 0; id < workers; ++id)
+            ranges[id].span.store(pack(int((long long)count*id/workers), int((long long)count*(id+1)/workers)), std::memory_order_relaxed);
+        remaining.store(count, std::memory_order_relaxed);
+        current_job = job;
+        current_arg = arg;
+        open.store(true, std::memory_order_seq_cst);        // công bố job (release các ghi ở trên)
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        if( sleepers.load(std::memory_order_seq_cst) > 0 )
+            wake_all();
+
+        inside_pool() = true;
+        execute(0, job, arg);
+        inside_pool() = false;
+
+        // Chờ các chỉ số đang chạy ở worker khác, rồi đóng job: worker đến muộn thấy open == false
+        // và bỏ qua; worker đã đăng ký (active) phải rời job trước khi run() trả về
+        for(int k = 0; remaining.load(std::memory_order_acquire) > 0; ++k)
+            relax(k);
+        open.store(false, std::memory_order_seq_cst);
+        for(int k = 0; active.load(std::memory_order_seq_cst) > 0; ++k)
+            relax(k);
+    }
+
+private:
+    struct alignas(64) Range
+    {
+        std::atomic<uint64_t> span{0};  // begin << 32 | end
+    };
+
+    static uint64_t pack(const int begin, const int end) { return (uint64_t(uint32_t(begin)) << 32) | uint32_t(end); }
+    static int begin_of(const uint64_t span) { return int(span >> 32); }
+    static int end_of(const uint64_t span) { return int(span & 0xffffffffu); }
+
+    //! true khi thread hiện tại đang chạy job của một pool
+    static bool & inside_pool()
+    {
+        thread_local bool inside = false;
+        return inside;
+    }
+
+    //! Một bước chờ bận: pause, sau 64 lần thì nhường CPU
+    static void relax(const int k)
+    {
+        if( k < 64 ) FGB_PAUSE();
+        else         std::this_thread::yield();
+    }
+
+    //! Ngủ cho đến khi epoch khác seen (có thể thức dậy sớm, caller phải kiểm tra lại)
+    void sleep(const uint32_t seen)
+    {
+#if defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&epoch), FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0);
+#else
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&]{ return epoch.load(std::memory_order_seq_cst) != seen; });
+#endif
+    }
+
+    //! Đánh thức mọi worker đang ngủ trên epoch
+    void wake_all()
+    {
+#if defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&epoch), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#else
+        { std::lock_guard<std::mutex> lock(mutex); }
+        wake.notify_all();
+#endif
+    }
+
+    //! Chờ epoch khác seen: spin trong spin micro giây, sau đó ngủ
+    uint32_t wait_epoch(const uint32_t seen)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(spin);
+        for(int k = 0; ; ++k)
+        {
+            const uint32_t now = epoch.load(std::memory_order_acquire);
+            if( now != seen )
+                return now;
+            if( (k & 63) == 63 && std::chrono::steady_clock::now() >= deadline )
+                break;
+            FGB_PAUSE();
+        }
+        for(;;)
+        {
+            sleepers.fetch_add(1, std::memory_order_seq_cst);
+            const uint32_t now = epoch.load(std::memory_order_seq_cst);
+            if( now == seen )
+                sleep(seen);
+            sleepers.fetch_sub(1, std::memory_order_seq_cst);
+            if( now != seen )
+                return now;
+            const uint32_t after = epoch.load(std::memory_order_acquire);
+            if( after != seen )
+                return after;
+        }
+    }
+
+    //! Lấy chỉ số đầu dải của worker self
+    bool pop(const int self, int & index)
+    {
+        uint64_t span = ranges[self].span.load(std::memory_order_relaxed);
+        while( begin_of(span) < end_of(span) )
+        {
+            if( ranges[self].span.compare_exchange_weak(span, pack(begin_of(span)+1, end_of(span)), std::memory_order_acq_rel) )
+            {
+                index = begin_of(span);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //! Lấy trộm nửa sau dải của một worker khác: chạy chỉ số đầu tiên, phần còn lại thành dải của self
+    bool steal(const int self, int & index)
+    {
+        for(int k = 1; k < workers; ++k)
+        {
+            Range & victim = ranges[(self + k) % workers];
+            uint64_t span = victim.span.load(std::memory_order_relaxed);
+            while( begin_of(span) < end_of(span) )
+            {
+                const int begin = begin_of(span), end = end_of(span);
+                const int mid = begin + (end - begin)/2;
+                if( victim.span.compare_exchange_weak(span, pack(begin, mid), std::memory_order_acq_rel) )
+                {
+                    index = mid;
+                    ranges[self].span.store(pack(mid+1, end), std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    //! Chạy các chỉ số của worker self (và lấy trộm) cho đến khi không còn chỉ số nào
+    void execute(const int self, void (*job)(void *, int), void * arg)
+    {
+        int index;
+        while( pop(self, index) || steal(self, index) )
+        {
+            job(arg, index);
+            remaining.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    void worker_loop(const int id)
+    {
+        inside_pool() = true;
+        uint32_t seen = epoch.load(std::memory_order_acquire);
+        for(;;)
+        {
+            seen = wait_epoch(seen);
+            if( stop.load(std::memory_order_acquire) )
+                return;
+            // Đăng ký trước rồi mới kiểm tra open (cặp seq_cst đối xứng với run()): hoặc run() thấy
+            // active > 0 và chờ, hoặc worker thấy job đã đóng
+            active.fetch_add(1, std::memory_order_seq_cst);
+            if( open.load(std::memory_order_seq_cst) )
+                execute(id, current_job, current_arg);
+            active.fetch_sub(1, std::memory_order_seq_cst);
+        }
+    }
+
+    const int workers;
+    const int spin;
+    std::unique_ptr<Range[]> ranges;
+    std::vector<std::thread> threads_;
+
+    alignas(64) std::atomic<uint32_t> epoch{0};     // tăng mỗi job mới (và khi dừng)
+    alignas(64) std::atomic<int> remaining{0};      // số chỉ số chưa xong của job hiện tại
+    alignas(64) std::atomic<int> active{0};         // số worker nền đang ở trong job
+    std::atomic<int> sleepers{0};                   // số worker đang (sắp) ngủ trên futex
+    std::atomic<bool> open{false};                  // job hiện tại còn nhận worker
+    std::atomic<bool> stop{false};
+    void (*current_job)(void *, int) = nullptr;     // ghi trước open = true, đọc sau khi thấy open
+    void * current_arg = nullptr;
+
+    std::mutex submit;                  // xếp hàng các lời gọi run() đồng thời
+#if !defined(__linux__)
+    std::mutex mutex;                   // cho condition variable khi không có futex
+    std::condition_variable wake;
+#endif
+};
+
+//! Pool tích hợp dùng chung, tạo ở lần dùng đầu tiên với blur_backend().threads worker
+inline BlurThreadPool & blur_thread_pool()
+{
+    const BlurBackend & backend = blur_backend();
+    static BlurThreadPool pool(backend.threads > 0 ? backend.threads : hardware_threads(), backend.spin_us, backend.pin);
+    return pool;
+}
+
+//! Số worker mà run_workers sẽ dùng với backend hiện tại
+inline int worker_count()
+{
+    const BlurBackend & backend = blur_backend();
+    switch(backend.kind)
+    {
+#if USE_OPENMP && defined(_OPENMP)
+        case kBackendOpenMP:    return omp_get_max_threads();
+#endif
+        case kBackendPool:      return blur_thread_pool().size();
+        case kBackendExecutor:  return backend.threads > 0 ? backend.threads : hardware_threads();
+        default:                return 1;
+    }
+}
+
+//!
+//! \brief Chạy worker(i) cho i trong [0, count) trên backend hiện tại và chờ tất cả xong.
+//! count <= 1 chạy trực tiếp trên thread gọi, không đánh thức backend.
+//! Các worker phải tự chia việc với nhau (ví dụ bằng ticket như BlurGraph::work) và không được
+//! giả định rằng chúng chạy đồng thời.
+//!
+template<typename F>
+inline void run_workers(const int count, F && worker)
+{
+    using Worker = std::remove_reference_t<F>;
+    auto job = [](void * arg, int index){ (*static_cast<Worker *>(arg))(index); };
+    const BlurBackend & backend = blur_backend();
+    if( count <= 1 )
+    {
+        if( count == 1 ) worker(0);
+        return;
+    }
+    switch(backend.kind)
+    {
+#if USE_OPENMP
+        case kBackendOpenMP:
+            OMP_PARALLEL_FOR_THREADS(count)
+            for(int i = 0; i < count; ++i)
+                worker(i);
+            return;
+#endif
+        case kBackendPool:
+            blur_thread_pool().run(count, job, (void *)&worker);
+            return;
+        case kBackendExecutor:
+            if( backend.executor )
+            {
+                backend.executor(backend.user, count, job, (void *)&worker);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    for(int i = 0; i < count; ++i)
+        worker(i);
+}
+
+//!
+//! \brief Đo các hệ số của mô hình chi phí trên máy hiện tại (vài chục ms):
+//! - cost_pass_ns, cost_flip_ns: một box pass và một lần chuyển vị tuần tự trên ảnh uchar RGBA
+//!   1024x256 (vừa cache, như một band), best of 5
+//! - cost_thread_ns: thời gian một run_workers rỗng trên mọi worker của backend, chia cho số worker
+//!
+inline void calibrate_cost_model(BlurPlan & plan)
+{
+    const int w = 1024, h = 256, C = 4;
+    const double elements = double(w)*h*C;
+    std::vector<uint8_t> src(std::size_t(w)*h*C), dst(src.size());
+    for(std::size_t i = 0; i < src.size(); ++i)
+        src[i] = uint8_t(i*7);
+
+    const auto best_of = [](auto && fn)
+    {
+        double time = 1e30;
+        for(int run = 0; run < 5; ++run)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            fn();
+            const auto end = std::chrono::steady_clock::now();
+            time = std::min(time, std::chrono::duration<double, std::nano>(end - start).count());
+        }
+        return time;
+    };
+
+    // Gọi kernel trực tiếp với tham số của plan: hàm này chạy trong lúc khởi tạo blur_plan()
+    plan.cost_pass_ns = float(best_of([&]{ horizontal_blur_extend<uint8_t,C,kSmall>(src.data(), dst.data(), w, h, 8, plan.prefetch_row_bytes); }) / elements);
+    const int inner = BlurPlan::block_side(plan.flip_l1_bytes, C, flip_tile<C>::size);
+    plan.cost_flip_ns = float(best_of([&]{ flip_block_region<uint8_t,C>(src.data(), dst.data(), w, h, 0, w, 0, h, inner, plan.prefetch_flip_tiles); }) / elements);
+
+    const int workers = worker_count();
+    if( workers > 1 )
+    {
+        const int runs = 200;
+        const double time = best_of([&]{ for(int i = 0; i < runs; ++i) run_workers(workers, [](int){}); }) / runs;
+        plan.cost_thread_ns = float(time / workers);
+    }
+}
+
+//!
+//! \brief Hàm này chuyển đổi độ lệch chuẩn (standard deviation) của Gaussian blur 
+//! thành bán kính box (box radius) cho mỗi lần box blur pass.
+//! Trả về giá trị sigma xấp xỉ đạt được với N lần box blur passes.
+//!
+//! Thuật toán dựa trên công thức từ paper của Peter Kovesi để xấp xỉ Gaussian blur
+//! bằng nhiều lần box blur. Việc sử dụng các box có kích thước khác nhau giúp
+//! xấp xỉ Gaussian tốt hơn so với dùng cùng một kích thước.
+//!
+//! Tài liệu tham khảo:
+//! - https://www.peterkovesi.com/papers/FastGaussianSmoothing.pdf
+//!
+//! \param[out] boxes   Mảng chứa bán kính box cho mỗi pass (kernel sizes = 2*boxes[i]+1)
+//! \param[in] sigma    Độ lệch chuẩn Gaussian mong muốn
+//! \param[in] n        Số lần box blur passes
+//! \return             Giá trị sigma xấp xỉ đạt được
+//!
+inline float sigma_to_box_radius(int boxes[], const float sigma, const int n)
+{
+    // Tính kích thước filter lý tưởng (ideal filter width) từ sigma và số passes
+    // Công thức: wi = sqrt(12*sigma^2/n + 1)
+    // Đây là kích thước box filter tối ưu để xấp xỉ Gaussian với n passes
+    float wi = std::sqrt((12*sigma*sigma/n)+1);
+    
     // Làm tròn xuống đến số lẻ gần nhất (box filter cần kích thước lẻ)
     int wl = wi;  // không cần std::floor vì cast tự động làm tròn xuống
     if(wl%2==0) wl--;  // Đảm bảo số lẻ (ví dụ: 4 -> 3, 5 -> 5)
@@ -968,199 +2449,1812 @@ inline float sigma_to_box_radius(int boxes[], const float sigma, const int n)
     for(int i=0; i<n; i++)
         boxes[i] = ((i < m ? wl : wu) - 1) / 2;  // Chuyển từ width sang radius
 
-    // Trả về sigma xấp xỉ thực tế đạt được với cấu hình này
-    return std::sqrt((m*wl*wl+(n-m)*wu*wu-n)/12.f);
+    // Trả về sigma xấp xỉ thực tế đạt được với cấu hình này
+    return std::sqrt((m*wl*wl+(n-m)*wu*wu-n)/12.f);
+}
+
+//!
+//! \brief Cách xấp xỉ Gaussian bằng chuỗi box blur
+//!
+enum BoxMode
+{
+    kBoxInteger,    // Box độ rộng lẻ nguyên (Kovesi): sigma đạt được dao động quanh sigma yêu cầu
+    kBoxExtended,   // Extended box (Gwosdek): thêm trọng số lẻ ở hai đầu box, đạt đúng sigma yêu cầu
+};
+
+//! Extended box (bán kính nguyên r, trọng số tap đầu alpha) có đúng phương sai variance (xem bên dưới)
+inline void extended_box(const double variance, int & r, double & alpha)
+{
+    r = std::max(0, int(std::floor(0.5*std::sqrt(12*variance + 1) - 0.5)));
+    const double base = r*(r+1)/3.0;   // phương sai của box bán kính r
+    alpha = std::max(0.0, (2*r+1)*(variance - base) / (2*((r+1.0)*(r+1.0) - variance)));
+}
+
+//!
+//! \brief Tính extended box cho N pass đạt đúng sigma yêu cầu (Gwosdek et al., "Theoretical
+//! Foundations of Gaussian Convolution by Extended Box Filtering", SSVM 2011).
+//!
+//! Mỗi pass mang phương sai sigma^2/n. Box bán kính r có phương sai r(r+1)/3; chọn r lớn nhất
+//! không vượt quá phương sai đó, rồi giải trọng số alpha của hai tap ở khoảng cách r+1:
+//!     sigma^2/n = ((2r+1)*r(r+1)/3 + 2*alpha*(r+1)^2) / (2r+1+2*alpha)
+//! Với r như trên thì 0 <= alpha < 1.
+//!
+//! \param[out] boxes   Bán kính phần nguyên của box cho mỗi pass
+//! \param[out] alphas  Trọng số tap đầu cho mỗi pass (xem horizontal_blur_extended)
+//! \param[in] sigma    Độ lệch chuẩn Gaussian mong muốn
+//! \param[in] n        Số lần box blur passes
+//! \return             Giá trị sigma đạt được (bằng sigma yêu cầu, sai số làm tròn float)
+//!
+inline float sigma_to_extended_box(int boxes[], float alphas[], const float sigma, const int n)
+{
+    int r;
+    double alpha;
+    extended_box(double(sigma)*sigma/n, r, alpha);
+    const double base = r*(r+1)/3.0;
+    for(int i=0; i<n; i++)
+    {
+        boxes[i] = r;
+        alphas[i] = float(alpha);
+    }
+
+    const double achieved = ((2*r+1)*base + 2*alpha*(r+1.0)*(r+1.0)) / (2*r+1 + 2*alpha);
+    return float(std::sqrt(n*achieved));
+}
+
+//!
+//! \brief Box của N pass theo mode: kBoxInteger dùng sigma_to_box_radius (alphas = 0),
+//! kBoxExtended dùng sigma_to_extended_box. Trả về giá trị sigma đạt được.
+//!
+inline float sigma_to_boxes(int boxes[], float alphas[], const float sigma, const int n, const BoxMode mode)
+{
+    if( mode == kBoxExtended )
+        return sigma_to_extended_box(boxes, alphas, sigma, n);
+    std::fill(alphas, alphas+n, 0.f);
+    return sigma_to_box_radius(boxes, sigma, n);
+}
+
+// ================================================================
+// THỐNG KÊ THEO GIAI ĐOẠN (FGB_STATS)
+// ================================================================
+//
+// Biên dịch với FGB_STATS=1 để ghi lại thời gian của từng giai đoạn trong mỗi lần blur:
+// - kStageHorizontal : các pass ngang (task H của blur_graph, hoặc dải hàng của một thread)
+// - kStageFlip       : lần chuyển vị thứ nhất
+// - kStageVertical   : các pass trên ảnh chuyển vị (= pass dọc)
+// - kStageFlipBack   : lần chuyển vị ngược về out
+// Mỗi sự kiện gồm thread, thời điểm bắt đầu/kết thúc và số byte đọc + ghi. Sau lần blur, kết
+// quả đọc được bằng last_blur_stats() (tổng theo giai đoạn, thời gian bận của từng thread, độ mất
+// cân bằng) hoặc ghi ra trace JSON của Chrome (chrome://tracing, Perfetto) bằng write_chrome_trace().
+// Với FGB_STATS=0 (mặc định) các macro FGB_STAGE / FGB_STATS_CALL rỗng: không có chi phí nào.
+// Các lần blur chạy đồng thời (async, batch) dùng chung bộ ghi: khi đó thống kê là của cả nhóm.
+//
+
+//! Các giai đoạn của pipeline blur
+enum BlurStage
+{
+    kStageHorizontal,
+    kStageFlip,
+    kStageVertical,
+    kStageFlipBack,
+    kStageCount
+};
+
+//! Tên giai đoạn (dùng trong trace)
+inline const char * blur_stage_name(const int stage)
+{
+    static const char * names[kStageCount] = { "horizontal", "flip", "vertical", "flip_back" };
+    return stage >= 0 && stage < kStageCount ? names[stage] : "?";
+}
+
+//! Một đoạn công việc của một thread
+struct BlurEvent
+{
+    int stage;              // BlurStage
+    int thread;             // id ổn định của thread (blur_stats_thread)
+    double start_us;        // thời điểm bắt đầu/kết thúc (µs, đồng hồ steady_clock)
+    double end_us;
+    std::size_t bytes;      // số byte đọc + ghi
+};
+
+//! Thống kê của một lần blur
+struct BlurStats
+{
+    double wall_us = 0;                     // thời gian của cả lần gọi
+    int workers = 0;                        // số worker được giao
+    double stage_us[kStageCount] = {};      // tổng thời gian của các sự kiện theo giai đoạn
+    std::size_t stage_bytes[kStageCount] = {};
+    int stage_events[kStageCount] = {};
+    std::vector<double> thread_busy_us;     // thời gian bận của từng thread có ghi sự kiện
+    double imbalance = 1;                   // bận lâu nhất / bận trung bình trên workers
+    std::size_t dropped = 0;                // sự kiện bị bỏ vì vượt dung lượng bộ ghi
+    std::vector<BlurEvent> events;
+};
+
+//! Thời điểm hiện tại (µs)
+inline double blur_stats_clock()
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//! Id ổn định, nhỏ của thread hiện tại (cấp lần lượt từ 0)
+inline int blur_stats_thread()
+{
+    static std::atomic<int> next{0};
+    thread_local const int id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+//!
+//! \brief Bộ ghi sự kiện: mảng cấp phát sẵn, mỗi sự kiện lấy một ô bằng fetch_add (không khóa,
+//! không cấp phát trong lúc blur). Sự kiện vượt dung lượng bị bỏ và được đếm.
+//!
+class BlurStatsRecorder
+{
+public:
+    static constexpr std::size_t capacity = 1 << 16;
+
+    BlurStatsRecorder() : events(capacity) {}
+
+    void begin(const int workers)
+    {
+        if( depth++ > 0 )       // lời gọi lồng nhau hoặc đồng thời: gộp vào lần đang ghi
+            return;
+        count.store(0, std::memory_order_relaxed);
+        call_workers = workers;
+        call_start = blur_stats_clock();
+    }
+
+    void record(const int stage, const double start, const double end, const std::size_t bytes)
+    {
+        const std::size_t slot = count.fetch_add(1, std::memory_order_relaxed);
+        if( slot < capacity )
+            events[slot] = BlurEvent{ stage, blur_stats_thread(), start, end, bytes };
+    }
+
+    void end()
+    {
+        if( --depth > 0 )
+            return;
+        BlurStats stats;
+        stats.wall_us = blur_stats_clock() - call_start;
+        stats.workers = call_workers;
+        const std::size_t recorded = count.load(std::memory_order_acquire);
+        stats.dropped = recorded > capacity ? recorded - capacity : 0;
+        stats.events.assign(events.begin(), events.begin() + std::min(recorded, capacity));
+        for(const BlurEvent & e : stats.events)
+        {
+            stats.stage_us[e.stage] += e.end_us - e.start_us;
+            stats.stage_bytes[e.stage] += e.bytes;
+            stats.stage_events[e.stage]++;
+        }
+
+        // Thời gian bận theo thread, đánh số lại theo thứ tự xuất hiện
+        std::vector<int> ids;
+        for(const BlurEvent & e : stats.events)
+        {
+            const auto it = std::find(ids.begin(), ids.end(), e.thread);
+            const std::size_t index = it - ids.begin();
+            if( it == ids.end() )
+            {
+                ids.push_back(e.thread);
+                stats.thread_busy_us.push_back(0);
+            }
+            stats.thread_busy_us[index] += e.end_us - e.start_us;
+        }
+        double busy = 0, longest = 0;
+        for(const double t : stats.thread_busy_us)
+        {
+            busy += t;
+            longest = std::max(longest, t);
+        }
+        const int slots = std::max<int>(std::max(1, call_workers), int(ids.size()));
+        stats.imbalance = busy > 0 ? longest / (busy / slots) : 1;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        last = std::move(stats);
+    }
+
+    BlurStats snapshot()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return last;
+    }
+
+private:
+    std::vector<BlurEvent> events;
+    std::atomic<std::size_t> count{0};
+    std::atomic<int> depth{0};
+    int call_workers = 0;
+    double call_start = 0;
+    std::mutex mutex;
+    BlurStats last;
+};
+
+inline BlurStatsRecorder & blur_stats_recorder()
+{
+    static BlurStatsRecorder recorder;
+    return recorder;
+}
+
+//! Thống kê của lần blur gần nhất (rỗng nếu FGB_STATS=0)
+inline BlurStats last_blur_stats()
+{
+    return blur_stats_recorder().snapshot();
+}
+
+//! Ghi các sự kiện của stats ra file trace JSON của Chrome. Trả về false nếu không ghi được
+inline bool write_chrome_trace(const BlurStats & stats, const char * path)
+{
+    FILE * file = std::fopen(path, "w");
+    if( !file )
+        return false;
+    const double origin = stats.events.empty() ? 0 : std::min_element(stats.events.begin(), stats.events.end(),
+        [](const BlurEvent & a, const BlurEvent & b){ return a.start_us < b.start_us; })->start_us;
+    std::fprintf(file, "{\"traceEvents\":[\n");
+    for(std::size_t i = 0; i < stats.events.size(); ++i)
+    {
+        const BlurEvent & e = stats.events[i];
+        std::fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%zu}}%s\n",
+                     blur_stage_name(e.stage), e.thread, e.start_us - origin, e.end_us - e.start_us, e.bytes,
+                     i+1 < stats.events.size() ? "," : "");
+    }
+    std::fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+    return std::fclose(file) == 0;
+}
+
+//! Ghi một sự kiện cho phạm vi (scope) hiện tại: từ lúc tạo đến lúc hủy
+struct BlurStageTimer
+{
+    BlurStageTimer(const int s, const std::size_t b) : stage(s), bytes(b), start(blur_stats_clock()) {}
+    ~BlurStageTimer() { blur_stats_recorder().record(stage, start, blur_stats_clock(), bytes); }
+    const int stage;
+    const std::size_t bytes;
+    const double start;
+};
+
+//! Bao một lần blur: bắt đầu và kết thúc một lần ghi
+struct BlurStatsCall
+{
+    explicit BlurStatsCall(const int workers) { blur_stats_recorder().begin(workers); }
+    ~BlurStatsCall() { blur_stats_recorder().end(); }
+};
+
+#if FGB_STATS
+    #define FGB_STAGE(stage, bytes) const BlurStageTimer fgb_stage_timer(stage, bytes)
+    #define FGB_STATS_CALL(workers) const BlurStatsCall fgb_stats_call(workers)
+#else
+    #define FGB_STAGE(stage, bytes) ((void)0)
+    #define FGB_STATS_CALL(workers) ((void)0)
+#endif
+
+// ================================================================
+// LẬP LỊCH THEO PHỤ THUỘC (WAVEFRONT / TASK GRAPH)
+// ================================================================
+//
+// Thay vì 2N pass toàn ảnh ngăn cách bởi barrier, pipeline được chia thành các task nhỏ nối với
+// nhau bằng phụ thuộc dữ liệu:
+// - H(b)    : N horizontal pass liên tiếp trên band b (bh hàng) khi band còn nóng trong L2:
+//             in[b] -> tạm -> ... -> out[b]
+// - T1(d,g) : chuyển vị tile (cột của band dọc d) x (hàng của nhóm band g): out -> in.
+//             Chờ H của các band trong nhóm g, và H của các band có hàng của in bị tile ghi đè
+// - V(d)    : N pass trên band d của ảnh chuyển vị (vb hàng dài h): in[d] -> tạm -> in[d].
+//             Chờ mọi T1(d,*)
+// - T2(d,g) : chuyển vị ngược tile về out. Chờ V(d) và mọi T1(*,g) (các tile đọc những hàng
+//             của out mà T2 sắp ghi)
+// Các task được đánh số theo thứ tự topo (H..., T1(0,*), V(0), T1(1,*), V(1), ..., T2...) và
+// mỗi worker nhận task kế tiếp bằng một fetch_add. Mọi phụ thuộc của một task có số nhỏ hơn,
+// tức đã được một worker đang chạy nhận, nên việc chờ không thể deadlock - kể cả khi chỉ có
+// một worker. Kết quả nằm trong out, in chỉ được dùng làm buffer tạm.
+//
+
+//! Chờ đến khi counter >= target: spin ngắn rồi nhường CPU (tránh đốt core khi oversubscribe)
+inline void wait_for(const std::atomic<int> & counter, const int target)
+{
+    for(int spin = 0; counter.load(std::memory_order_acquire) < target; ++spin)
+    {
+        if( spin < 64 ) FGB_PAUSE();
+        else            std::this_thread::yield();
+    }
+}
+
+//! Buffer tạm riêng của thread hiện tại (giữ lại giữa các lần gọi), ít nhất count phần tử
+template<typename T>
+inline T * band_scratch(const std::size_t count)
+{
+    thread_local std::vector<T> scratch;
+    if( scratch.size() < count )
+        scratch.resize(count);
+    return scratch.data();
+}
+
+//! Chuỗi box pass của một trục: bán kính, trọng số tap đầu của extended box (0: box nguyên) và số pass
+struct BoxPasses
+{
+    const int * boxes;
+    const float * alphas;
+    int n;
+};
+
+//!
+//! \brief Các pass của chuỗi box trên rows hàng dài len: src -> tmp0/tmp1 luân phiên -> dst
+//! (dst có thể trùng src). Dải hàng nhỏ (band) giữ nguyên trong cache giữa các pass.
+//! Với step > 1, pass cuối chỉ ghi mỗi mẫu thứ step vào dst (hàng dài (len+step-1)/step, dst khác src).
+//!
+template<typename T, int C, Border P>
+inline void band_passes(const T * src, T * dst, const int len, const int rows, const BoxPasses & box, T * tmp0, T * tmp1, const int step = 1)
+{
+    T * tmp[2] = { tmp0, tmp1 };
+    for(int i = 0; i < box.n; ++i)
+    {
+        T * target = (i == box.n-1 && src != dst) ? dst : tmp[i%2];
+        if( step > 1 && i == box.n-1 )
+            horizontal_blur_extended<T,C,P>(src, target, len, rows, box.boxes[i], box.alphas[i], blur_plan().prefetch_row_bytes, step);
+        else
+            horizontal_blur_rows<T,C,P>(src, target, len, rows, box.boxes[i], box.alphas[i]);
+        src = target;
+    }
+    if( src != dst )    // n == 1 tại chỗ: kết quả đang ở tmp0
+        std::memcpy(dst, src, std::size_t(rows)*len*C*sizeof(T));
+}
+
+//!
+//! \brief Đồ thị task của một lần blur (xem mô tả ở đầu phần). Tạo một lần, sau đó mọi worker
+//! gọi work() đồng thời; work() trả về khi không còn task để nhận.
+//!
+//! \tparam T   Kiểu dữ liệu pixel
+//! \tparam C   Số kênh màu
+//! \tparam P   Chính sách xử lý biên
+//!
+template<typename T, int C, Border P>
+class BlurGraph
+{
+public:
+    //! \param[in,out] src      Ảnh nguồn, bị ghi đè (dùng làm buffer tạm)
+    //! \param[out] dst         Ảnh kết quả
+    //! \param[in] width, height Kích thước ảnh
+    //! \param[in] horizontal   Chuỗi box của các pass ngang, n >= 1 (mảng phải sống lâu hơn đồ thị)
+    //! \param[in] vertical     Chuỗi box của các pass dọc, n >= 1
+    //! \param[in] plan         Kích thước band và block chuyển vị
+    //! \param[in] streaming    Ghi lần chuyển vị cuối bằng non-temporal store
+    BlurGraph(T * src, T * dst, const int width, const int height, const BoxPasses & horizontal, const BoxPasses & vertical, const BlurPlan & plan, const bool streaming)
+    : in(src), out(dst), w(width), h(height), hbox(horizontal), vbox(vertical), stream(streaming), prefetch(plan.prefetch_flip_tiles)
+    {
+        inner = BlurPlan::block_side(plan.flip_l1_bytes, sizeof(T)*C, flip_tile<sizeof(T)*C>::size);
+        const int outer = std::max(inner, BlurPlan::block_side(plan.flip_l2_bytes, sizeof(T)*C, inner));
+
+        bh = plan.band_rows((long long)w*C*sizeof(T), h);
+        vb = plan.band_rows((long long)h*C*sizeof(T), w);
+        gb = std::max(1, outer/bh);     // tile T1/T2 cao khoảng một block ngoài của flip_block
+        nb = (h + bh-1)/bh;
+        nd = (w + vb-1)/vb;
+        ng = (nb + gb-1)/gb;
+
+        const int count = nb + 2*nd + ng;
+        counters.reset(new std::atomic<int>[count]);
+        for(int i = 0; i < count; ++i)
+            counters[i].store(0, std::memory_order_relaxed);
+        h_done  = counters.get();
+        t1_done = h_done + nb;
+        v_done  = t1_done + nd;
+        t1_read = v_done + nd;
+    }
+
+    //! Tổng số task của đồ thị
+    int tasks() const { return nb + nd*(ng+1) + nd*ng; }
+
+    //! Vòng lặp của một worker: nhận task theo thứ tự topo và thực thi cho đến khi hết
+    void work()
+    {
+        const std::size_t band = std::max(std::size_t(bh)*w, std::size_t(vb)*h)*C;
+        T * tmp = band_scratch<T>(2*band);
+        const int total = tasks();
+        for(int task = ticket.fetch_add(1, std::memory_order_relaxed); task < total; task = ticket.fetch_add(1, std::memory_order_relaxed))
+            run(task, tmp, tmp + band);
+    }
+
+private:
+    void run(int task, T * tmp0, T * tmp1)
+    {
+        if( task < nb )
+            return horizontal(task, tmp0, tmp1);
+        task -= nb;
+        if( task < nd*(ng+1) )
+        {
+            const int d = task/(ng+1), j = task%(ng+1);
+            if( j < ng )    flip_forward(d, j);
+            else            vertical(d, tmp0, tmp1);
+            return;
+        }
+        task -= nd*(ng+1);
+        flip_back(task/ng, task%ng);
+    }
+
+    //! Dải hàng [y0, y1) của ảnh gốc thuộc nhóm band g
+    void group_rows(const int g, int & y0, int & y1) const
+    {
+        y0 = g*gb*bh;
+        y1 = std::min(h, (g+1)*gb*bh);
+    }
+
+    //! Dải hàng [x0, x1) của ảnh chuyển vị (= cột của ảnh gốc) thuộc band dọc d
+    void band_cols(const int d, int & x0, int & x1) const
+    {
+        x0 = d*vb;
+        x1 = std::min(w, x0+vb);
+    }
+
+    void horizontal(const int b, T * tmp0, T * tmp1)
+    {
+        const int y0 = b*bh, y1 = std::min(h, y0+bh);
+        const std::size_t offset = std::size_t(y0)*w*C;
+        {
+            FGB_STAGE(kStageHorizontal, 2*std::size_t(hbox.n)*(y1-y0)*w*C*sizeof(T));
+            band_passes<T,C,P>(in + offset, out + offset, w, y1-y0, hbox, tmp0, tmp1);
+        }
+        h_done[b].store(1, std::memory_order_release);
+    }
+
+    void flip_forward(const int d, const int g)
+    {
+        int x0, x1, y0, y1;
+        band_cols(d, x0, x1);
+        group_rows(g, y0, y1);
+
+        // Hàng nguồn của tile đã qua đủ N pass ngang
+        for(int b = g*gb; b < std::min(nb, (g+1)*gb); ++b)
+            wait_for(h_done[b], 1);
+        // Tile ghi hàng [x0, x1) của ảnh chuyển vị, tức phần tử [x0*h, x1*h) của in = hàng gốc
+        // [x0*h/w, ceil(x1*h/w)): các band H đọc những hàng đó phải xong trước
+        const int r0 = int((long long)x0*h/w), r1 = int(((long long)x1*h + w-1)/w);
+        for(int b = r0/bh; b <= (r1-1)/bh; ++b)
+            wait_for(h_done[b], 1);
+
+        {
+            FGB_STAGE(kStageFlip, 2*std::size_t(x1-x0)*(y1-y0)*C*sizeof(T));
+            flip_block_region<T,C,false>(out, in, w, h, x0, x1, y0, y1, inner, prefetch);
+        }
+        t1_done[d].fetch_add(1, std::memory_order_release);
+        t1_read[g].fetch_add(1, std::memory_order_release);
+    }
+
+    void vertical(const int d, T * tmp0, T * tmp1)
+    {
+        wait_for(t1_done[d], ng);
+        int x0, x1;
+        band_cols(d, x0, x1);
+        T * band = in + std::size_t(x0)*h*C;
+        {
+            FGB_STAGE(kStageVertical, 2*std::size_t(vbox.n)*(x1-x0)*h*C*sizeof(T));
+            band_passes<T,C,P>(band, band, h, x1-x0, vbox, tmp0, tmp1);
+        }
+        v_done[d].store(1, std::memory_order_release);
+    }
+
+    void flip_back(const int d, const int g)
+    {
+        wait_for(v_done[d], 1);
+        wait_for(t1_read[g], nd);   // hàng [y0, y1) của out không còn tile T1 nào cần đọc
+        int x0, x1, y0, y1;
+        band_cols(d, x0, x1);
+        group_rows(g, y0, y1);
+        FGB_STAGE(kStageFlipBack, 2*std::size_t(x1-x0)*(y1-y0)*C*sizeof(T));
+        if( stream )    flip_block_region<T,C,true >(in, out, h, w, y0, y1, x0, x1, inner, prefetch);
+        else            flip_block_region<T,C,false>(in, out, h, w, y0, y1, x0, x1, inner, prefetch);
+    }
+
+    T * const in;
+    T * const out;
+    const int w, h;
+    const BoxPasses hbox, vbox;
+    const bool stream;
+    const int prefetch;
+
+    int inner;      // block trong của flip_block_region
+    int bh, vb;     // số hàng của band ngang (ảnh gốc) và band dọc (ảnh chuyển vị)
+    int gb;         // số band ngang trong một nhóm (chiều cao tile chuyển vị)
+    int nb, nd, ng; // số band ngang, band dọc, nhóm
+
+    std::unique_ptr<std::atomic<int>[]> counters;
+    std::atomic<int> * h_done;      // H(b) xong
+    std::atomic<int> * t1_done;     // số tile T1(d,*) đã xong
+    std::atomic<int> * v_done;      // V(d) xong
+    std::atomic<int> * t1_read;     // số tile T1(*,g) đã đọc xong nhóm g
+    std::atomic<int> ticket{0};
+};
+
+//!
+//! \brief Blur bằng đồ thị task (BlurGraph) với workers worker trên backend đa luồng hiện tại
+//! (run_workers). Kết quả nằm trong out; in bị ghi đè.
+//!
+template<typename T, int C, Border P>
+inline void blur_graph(T * in, T * out, const int w, const int h, const BoxPasses & horizontal, const BoxPasses & vertical, const bool stream, const int workers)
+{
+    BlurGraph<T,C,P> graph(in, out, w, h, horizontal, vertical, blur_plan(), stream);
+    run_workers(workers, [&graph](int){ graph.work(); });
+}
+
+//!
+//! \brief Chỉ các pass ngang (sigma dọc bằng 0): không chuyển vị, không pass dọc. Mỗi worker nhận
+//! lần lượt các band như task H của BlurGraph: in -> tạm -> out. Kết quả nằm trong out, in không đổi.
+//! Với step > 1 pass cuối chỉ ghi mỗi mẫu thứ step: out gồm h hàng dài (w+step-1)/step.
+//!
+template<typename T, int C, Border P>
+inline void blur_rows(const T * in, T * out, const int w, const int h, const BoxPasses & box, const int workers, const int step = 1)
+{
+    const int ow = (w + step-1)/step;
+    const int bh = blur_plan().band_rows((long long)w*C*sizeof(T), h);
+    const int nb = (h + bh-1)/bh;
+    std::atomic<int> ticket{0};
+    run_workers(workers, [&](int)
+    {
+        const std::size_t band = std::size_t(bh)*w*C;
+        T * tmp = band_scratch<T>(2*band);
+        for(int b = ticket.fetch_add(1, std::memory_order_relaxed); b < nb; b = ticket.fetch_add(1, std::memory_order_relaxed))
+        {
+            const int y0 = b*bh, y1 = std::min(h, y0+bh);
+            FGB_STAGE(kStageHorizontal, 2*std::size_t(box.n)*(y1-y0)*w*C*sizeof(T));
+            band_passes<T,C,P>(in + std::size_t(y0)*w*C, out + std::size_t(y0)*ow*C, w, y1-y0, box, tmp, tmp + band, step);
+        }
+    });
+}
+
+//!
+//! \brief Chỉ các pass dọc (sigma ngang bằng 0): vertical_blur_strip trên từng dải cột, không chuyển
+//! vị. Mỗi worker nhận lần lượt các dải và chạy mọi pass của dải khi nó còn nóng trong cache:
+//! in -> out -> in ... Kết quả nằm trong out nếu số pass lẻ, trong in nếu chẵn.
+//!
+template<typename T, int C, Border P>
+inline void blur_columns(T * in, T * out, const int w, const int h, const BoxPasses & box, const int workers)
+{
+    // Dải rộng tối đa kStripBytes, hẹp lại để mỗi worker có khoảng hai dải, nhưng không dưới một cache line
+    const int widest = std::max(1, kStripBytes/int(sizeof(T)*C));
+    const int line = std::max(1, 64/int(sizeof(T)*C));
+    const int sw = std::min(widest, std::max(line, (w + 2*workers-1)/(2*workers)));
+    const int ns = (w + sw-1)/sw;
+    std::atomic<int> ticket{0};
+    run_workers(workers, [&](int)
+    {
+        for(int s = ticket.fetch_add(1, std::memory_order_relaxed); s < ns; s = ticket.fetch_add(1, std::memory_order_relaxed))
+        {
+            const int x0 = s*sw, x1 = std::min(w, x0+sw);
+            FGB_STAGE(kStageVertical, 2*std::size_t(box.n)*(x1-x0)*h*C*sizeof(T));
+            for(int i = 0; i < box.n; ++i)
+                vertical_blur_strip<T,C,P>(i%2 ? out : in, i%2 ? in : out, w, h, x0, x1, box.boxes[i], box.alphas[i]);
+        }
+    });
+}
+
+//!
+//! \brief Một phép chuyển vị trên workers worker của backend hiện tại (run_workers), cho các
+//! pipeline không mở team OpenMP: mỗi worker nhận lần lượt các block ngoài của flip_block_team
+//! bằng ticket. Thời gian được ghi vào giai đoạn stage (kStageFlip hoặc kStageFlipBack).
+//!
+template<typename T, int C>
+inline void flip_block_workers(const T * in, T * out, const int w, const int h, const bool stream, const int workers, const int stage)
+{
+    const BlurPlan & plan = blur_plan();
+    const int inner = BlurPlan::block_side(plan.flip_l1_bytes, sizeof(T)*C, flip_tile<sizeof(T)*C>::size);
+    const int outer = std::max(inner, BlurPlan::block_side(plan.flip_l2_bytes, sizeof(T)*C, inner));
+    const int nx = (w + outer-1)/outer, ny = (h + outer-1)/outer;
+    std::atomic<int> ticket{0};
+    run_workers(workers, [&](int)
+    {
+        for(int b = ticket.fetch_add(1, std::memory_order_relaxed); b < nx*ny; b = ticket.fetch_add(1, std::memory_order_relaxed))
+        {
+            const int x0 = b/ny*outer, x1 = std::min(w, x0+outer);
+            const int y0 = b%ny*outer, y1 = std::min(h, y0+outer);
+            FGB_STAGE(stage, 2*std::size_t(x1-x0)*(y1-y0)*C*sizeof(T));
+            if( stream )    flip_block_region<T,C,true >(in, out, w, h, x0, x1, y0, y1, inner, plan.prefetch_flip_tiles);
+            else            flip_block_region<T,C,false>(in, out, w, h, x0, x1, y0, y1, inner, plan.prefetch_flip_tiles);
+        }
+    });
+}
+
+//!
+//! \brief Hàm này thực hiện Fast Gaussian Blur. Được template hóa theo kiểu dữ liệu T và số passes N.
+//!
+//! Áp dụng nhiều lần box blur sẽ hội tụ về một Gaussian blur thật sự (nhờ định lý Central Limit).
+//! Ba passes là đủ để có kết quả tốt. Buffer input cũng được dùng làm temporary và bị sửa đổi
+//! trong quá trình xử lý nên không thể là const.
+//!
+//! Thông thường quá trình nên luân phiên giữa horizontal và vertical passes
+//! với số lần tương ứng với số box blur passes mong muốn. Tuy nhiên nhờ tính chất của box blur,
+//! các passes có thể tách biệt (separable) có thể thực hiện theo bất kỳ thứ tự nào mà không thay đổi kết quả.
+//! Vì lý do hiệu năng, thuật toán được tối ưu như sau:
+//! - Áp dụng N lần horizontal blur (horizontal passes)
+//! - Chuyển vị buffer ảnh (transposition) - biến horizontal thành vertical
+//! - Áp dụng N lần horizontal blur (thực chất là vertical passes trên ảnh đã transpose)
+//! - Chuyển vị lại buffer ảnh (transposition) - trả về dạng ban đầu
+//!
+//! Có hai phiên bản của hàm:
+//! - Generic N passes (dùng nhiều std::swap hơn)
+//! - Specialized 3 passes (tối ưu riêng cho 3 passes)
+//!
+//! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn (sẽ bị sửa đổi)
+//! \param[in,out] out      Con trỏ tham chiếu đến buffer đích (sẽ bị sửa đổi)
+//! \param[in] w            Chiều rộng ảnh
+//! \param[in] h            Chiều cao ảnh
+//! \param[in] c            Số kênh màu
+//! \param[in] sigma_x      Độ lệch chuẩn Gaussian theo chiều ngang
+//! \param[in] sigma_y      Độ lệch chuẩn Gaussian theo chiều dọc
+//! \param[in] mode         Cách xấp xỉ sigma bằng box (kBoxInteger, kBoxExtended)
+//!
+template<typename T, unsigned int N, Border P>
+inline void fast_gaussian_blur(T *& in, T *& out, const int w, const int h, const int c, const float sigma_x, const float sigma_y, const BoxMode mode) 
+{
+    // Tính toán kích thước box kernel cho mỗi pass của từng chiều
+    // Sử dụng công thức tối ưu để xấp xỉ Gaussian với N passes
+    int boxes[N], vboxes[N];
+    float alphas[N], valphas[N];
+    sigma_to_boxes(boxes, alphas, sigma_x, N, mode);
+    sigma_to_boxes(vboxes, valphas, sigma_y, N, mode);
+    const bool stream = blur_plan().stream_output(w, h);
+#if FGB_STATS
+    // Byte đọc + ghi của một thread: N pass trên dải hàng của nó, và phần chuyển vị của nó
+    const std::size_t flip_bytes = 2*std::size_t(w)*h*c*sizeof(T)/std::max(1, worker_count());
+    const std::size_t band_bytes = N*flip_bytes;
+#endif
+
+    // Toàn bộ pipeline chạy trong MỘT vùng song song: các pass dùng worksharing mồ côi
+    // (horizontal_blur_team, flip_block_team) thay vì mỗi pass tự fork/join một team.
+    // Mỗi thread giữ bản sao con trỏ riêng và hoán đổi giống hệt nhau.
+    OMP_PARALLEL
+    {
+        T * src = in;
+        T * dst = out;
+
+        // ================================================================
+        // BƯỚC 1: THỰC HIỆN N LẦN HORIZONTAL BLUR PASSES
+        // ================================================================
+        // Không có barrier giữa các pass: dải hàng của thread chỉ phụ thuộc pass trước của
+        // chính dải đó (xem horizontal_blur_team)
+        {
+            FGB_STAGE(kStageHorizontal, band_bytes);
+            for(unsigned int i = 0; i < N; ++i)
+            {
+                // Thực hiện horizontal blur với box radius boxes[i]
+                horizontal_blur_team<T,P>(src, dst, w, h, c, boxes[i], alphas[i]);
+                // Hoán đổi con trỏ: output của pass này trở thành input của pass tiếp theo
+                std::swap(src, dst);
+            }
+        }
+
+        // ================================================================
+        // BƯỚC 2: CHUYỂN VỊ (TRANSPOSE) BUFFER ẢNH
+        // ================================================================
+        // Transpose biến ảnh từ dạng row-major sang column-major
+        // Sau transpose: blur ngang trên ảnh gốc = blur dọc trên ảnh đã transpose
+        // Barrier: một block chuyển vị đọc hàng của nhiều thread
+        OMP_BARRIER
+        {
+            FGB_STAGE(kStageFlip, flip_bytes);
+            flip_block_team(src, dst, w, h, c);
+        }
+        std::swap(src, dst);  // Hoán đổi con trỏ sau transpose
+        
+        // ================================================================
+        // BƯỚC 3: THỰC HIỆN N LẦN HORIZONTAL BLUR TRÊN ẢNH ĐÃ TRANSPOSE
+        // ================================================================
+        // Vì ảnh đã được transpose, blur ngang trên ảnh transpose = blur dọc trên ảnh gốc
+        // Chú ý: w và h đã đổi chỗ sau transpose (w_old = h_new, h_old = w_new)
+        {
+            FGB_STAGE(kStageVertical, band_bytes);
+            for(unsigned int i = 0; i < N; ++i)
+            {
+                // Horizontal blur trên ảnh đã transpose (thực chất là vertical blur trên ảnh gốc)
+                horizontal_blur_team<T,P>(src, dst, h, w, c, vboxes[i], valphas[i]);
+                std::swap(src, dst);
+            }
+        }
+        
+        // ================================================================
+        // BƯỚC 4: CHUYỂN VỊ LẠI BUFFER ẢNH
+        // ================================================================
+        // Transpose lại để trả về dạng ban đầu (row-major)
+        // Chú ý: w và h vẫn đổi chỗ vì ta đang transpose lại
+        // Với ảnh rất lớn, output cuối không được đọc lại trong hàm: ghi bằng non-temporal store
+        OMP_BARRIER
+        FGB_STAGE(kStageFlipBack, flip_bytes);
+        flip_block_team(src, dst, h, w, c, stream);
+    }
+
+    // Các thread đã hoán đổi src/dst 2N+1 lần (số lẻ): kết quả nằm ở buffer in ban đầu,
+    // hoán đổi in/out để kết quả cuối cùng nằm trong out
+    std::swap(in, out);
+}
+
+// Phiên bản chuyên biệt cho 3 passes (biquadratic filter) - tối ưu hơn phiên bản generic
+// Tối ưu bằng cách giảm số lần swap và có thể được compiler optimize tốt hơn
+template<typename T, Border P>
+inline void fast_gaussian_blur(T *& in, T *& out, const int w, const int h, const int c, const float sigma_x, const float sigma_y, const BoxMode mode) 
+{
+    // Tính toán kích thước box kernel cho 3 passes của từng chiều
+    int boxes[3], vboxes[3];
+    float alphas[3], valphas[3];
+    sigma_to_boxes(boxes, alphas, sigma_x, 3, mode);
+    sigma_to_boxes(vboxes, valphas, sigma_y, 3, mode);
+    const bool stream = blur_plan().stream_output(w, h);
+#if FGB_STATS
+    const std::size_t flip_bytes = 2*std::size_t(w)*h*c*sizeof(T)/std::max(1, worker_count());
+    const std::size_t band_bytes = 3*flip_bytes;
+#endif
+
+    // Một vùng song song cho cả pipeline, barrier chỉ trước hai lần chuyển vị
+    // (xem phiên bản generic ở trên)
+    OMP_PARALLEL
+    {
+        // ================================================================
+        // BƯỚC 1: THỰC HIỆN 3 LẦN HORIZONTAL BLUR PASSES
+        // ================================================================
+        // Luân phiên sử dụng in và out để tránh copy không cần thiết
+        {
+            FGB_STAGE(kStageHorizontal, band_bytes);
+            horizontal_blur_team<T,P>(in, out, w, h, c, boxes[0], alphas[0]);  // Pass 1: in -> out
+            horizontal_blur_team<T,P>(out, in, w, h, c, boxes[1], alphas[1]);  // Pass 2: out -> in (đảo ngược)
+            horizontal_blur_team<T,P>(in, out, w, h, c, boxes[2], alphas[2]);  // Pass 3: in -> out
+        }
+        
+        // ================================================================
+        // BƯỚC 2: CHUYỂN VỊ (TRANSPOSE) BUFFER ẢNH
+        // ================================================================
+        // Chuyển vị ảnh: out (chứa kết quả 3 passes ngang) -> in (sẽ làm input cho passes dọc)
+        OMP_BARRIER
+        {
+            FGB_STAGE(kStageFlip, flip_bytes);
+            flip_block_team(out, in, w, h, c);
+        }
+        
+        // ================================================================
+        // BƯỚC 3: THỰC HIỆN 3 LẦN HORIZONTAL BLUR TRÊN ẢNH ĐÃ TRANSPOSE
+        // ================================================================
+        // Blur ngang trên ảnh transpose = blur dọc trên ảnh gốc
+        // Chú ý: w và h đã đổi chỗ (w_old = h_new, h_old = w_new)
+        {
+            FGB_STAGE(kStageVertical, band_bytes);
+            horizontal_blur_team<T,P>(in, out, h, w, c, vboxes[0], valphas[0]);  // Pass 1 (dọc): in -> out
+            horizontal_blur_team<T,P>(out, in, h, w, c, vboxes[1], valphas[1]);  // Pass 2 (dọc): out -> in
+            horizontal_blur_team<T,P>(in, out, h, w, c, vboxes[2], valphas[2]);  // Pass 3 (dọc): in -> out
+        }
+        
+        // ================================================================
+        // BƯỚC 4: CHUYỂN VỊ LẠI BUFFER ẢNH
+        // ================================================================
+        // Transpose lại để trả về dạng ban đầu
+        // Với ảnh rất lớn, output cuối không được đọc lại trong hàm: ghi bằng non-temporal store
+        OMP_BARRIER
+        FGB_STAGE(kStageFlipBack, flip_bytes);
+        flip_block_team(out, in, h, w, c, stream);
+    }
+    
+    // Hoán đổi con trỏ để kết quả cuối cùng nằm trong buffer out
+    std::swap(in, out);    
+}
+
+//!
+//! \brief Blur Gaussian một chiều theo hàng (chỉ chiều ngang): các pass ngang theo band (blur_rows),
+//! không chuyển vị và không pass dọc. Dùng cho profile đường, tín hiệu lưu theo hàng, hoặc chiều
+//! ngang của blur bất đẳng hướng. Kết quả nằm trong out, in không bị sửa; in và out có thể trùng nhau.
+//! sigma <= 0 hoặc n == 0: không blur, chỉ hoán đổi in/out.
+//!
+//! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn
+//! \param[in,out] out      Con trỏ tham chiếu đến buffer đích
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] sigma        Độ lệch chuẩn Gaussian theo chiều ngang
+//! \param[in] n            Số lần passes
+//! \param[in] mode         Cách xấp xỉ sigma bằng box
+//!
+template<typename T, Border P = kMirror>
+void fast_gaussian_blur_horizontal(T *& in, T *& out, const int w, const int h, const int c, const float sigma, const uint32_t n, const BoxMode mode)
+{
+    if( n < 1 || !(sigma > 0.f) )
+    {
+        std::swap(in, out);
+        return;
+    }
+
+    std::vector<int> boxes(n);
+    std::vector<float> alphas(n);
+    sigma_to_boxes(boxes.data(), alphas.data(), sigma, int(n), mode);
+    const BoxPasses box = { boxes.data(), alphas.data(), int(n) };
+
+    double pass_units = 0;
+    for(const int r : boxes)
+        pass_units += r < w/2 ? 1 : 2;
+    const int workers = blur_plan().threads_for(double(w)*h*c, pass_units, 0, worker_count());
+    FGB_STATS_CALL(workers);
+
+    switch(c)
+    {
+        case 1: blur_rows<T,1,P>(in, out, w, h, box, workers); break;
+        case 2: blur_rows<T,2,P>(in, out, w, h, box, workers); break;
+        case 3: blur_rows<T,3,P>(in, out, w, h, box, workers); break;
+        case 4: blur_rows<T,4,P>(in, out, w, h, box, workers); break;
+        default: printf("fast_gaussian_blur_horizontal over %d channels is not supported yet. Add a specific case if possible or fall back to the generic version.\n", c); break;
+    }
+}
+
+//!
+//! \brief Blur Gaussian một chiều theo cột (chỉ chiều dọc), không chuyển vị: các pass dọc chạy trực
+//! tiếp trên các dải cột của ảnh row-major (blur_columns, vertical_blur_strip). Dùng cho làm mượt
+//! theo thời gian khi mỗi hàng là một frame/mẫu, hoặc chiều dọc của blur bất đẳng hướng.
+//! Buffer in được dùng làm buffer tạm (như fast_gaussian_blur); kết quả cuối nằm trong out.
+//! sigma <= 0 hoặc n == 0: không blur, chỉ hoán đổi in/out.
+//!
+//! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn (sẽ bị sửa đổi)
+//! \param[in,out] out      Con trỏ tham chiếu đến buffer đích (sẽ bị sửa đổi)
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] sigma        Độ lệch chuẩn Gaussian theo chiều dọc
+//! \param[in] n            Số lần passes
+//! \param[in] mode         Cách xấp xỉ sigma bằng box
+//!
+template<typename T, Border P = kMirror>
+void fast_gaussian_blur_vertical(T *& in, T *& out, const int w, const int h, const int c, const float sigma, const uint32_t n, const BoxMode mode)
+{
+    if( n < 1 || !(sigma > 0.f) )
+    {
+        std::swap(in, out);
+        return;
+    }
+
+    std::vector<int> boxes(n);
+    std::vector<float> alphas(n);
+    sigma_to_boxes(boxes.data(), alphas.data(), sigma, int(n), mode);
+    const BoxPasses box = { boxes.data(), alphas.data(), int(n) };
+
+    double pass_units = 0;
+    for(const int r : boxes)
+        pass_units += r < h/2 ? 1 : 2;
+    const int workers = blur_plan().threads_for(double(w)*h*c, pass_units, 0, worker_count());
+    FGB_STATS_CALL(workers);
+
+    switch(c)
+    {
+        case 1: blur_columns<T,1,P>(in, out, w, h, box, workers); break;
+        case 2: blur_columns<T,2,P>(in, out, w, h, box, workers); break;
+        case 3: blur_columns<T,3,P>(in, out, w, h, box, workers); break;
+        case 4: blur_columns<T,4,P>(in, out, w, h, box, workers); break;
+        default: printf("fast_gaussian_blur_vertical over %d channels is not supported yet. Add a specific case if possible or fall back to the generic version.\n", c); return;
+    }
+    if( n%2 == 0 )      // số pass chẵn: kết quả đang ở in
+        std::swap(in, out);
+}
+
+//!
+//! \brief Hàm dispatcher template cho fast_gaussian_blur bất đẳng hướng (anisotropic): sigma và số
+//! passes riêng cho từng chiều. Template hóa theo kiểu dữ liệu T và border policy P.
+//!
+//! Một chiều có sigma <= 0 hoặc 0 pass được bỏ qua hoàn toàn, cùng với cả hai lần chuyển vị:
+//! - chỉ chiều ngang: fast_gaussian_blur_horizontal
+//! - chỉ chiều dọc: fast_gaussian_blur_vertical (dải cột, không chuyển vị)
+//! - cả hai chiều: đồ thị task (blur_graph), hoặc pipeline chia dải tĩnh theo N ở chế độ NUMA
+//!   (khi nx == ny; các pipeline đó dùng cùng số pass cho hai chiều)
+//! Không chiều nào cần blur thì chỉ hoán đổi in/out.
+//!
+//! Lưu ý NUMA: với BlurPlan::numa_bands, chỉ lời gọi có nx == ny chạy pipeline chia dải tĩnh khớp
+//! với bố cục first-touch (first_touch_alloc). Với nx != ny, blur vẫn đúng nhưng chạy bằng
+//! blur_graph, nơi band được nhận theo ticket: trang nhớ không còn bảo đảm nằm trên node của thread
+//! xử lý nó. Cần bố cục NUMA thì dùng cùng số pass cho hai chiều (sigma vẫn có thể khác nhau).
+//!
+//! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn (sẽ bị sửa đổi)
+//! \param[in,out] out      Con trỏ tham chiếu đến buffer đích (sẽ bị sửa đổi)
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] sigma_x      Độ lệch chuẩn Gaussian theo chiều ngang, 0 để không blur ngang
+//! \param[in] sigma_y      Độ lệch chuẩn Gaussian theo chiều dọc, 0 để không blur dọc
+//! \param[in] nx           Số passes theo chiều ngang
+//! \param[in] ny           Số passes theo chiều dọc
+//! \param[in] mode         Cách xấp xỉ sigma bằng box
+//!
+template<typename T, Border P = kMirror>
+void fast_gaussian_blur(T *& in, T *& out, const int w, const int h, const int c, const float sigma_x, const float sigma_y, const uint32_t nx, const uint32_t ny, const BoxMode mode)
+{
+    const bool blur_x = nx >= 1 && sigma_x > 0.f;
+    const bool blur_y = ny >= 1 && sigma_y > 0.f;
+    if( !blur_y )
+    {
+        fast_gaussian_blur_horizontal<T,P>(in, out, w, h, c, sigma_x, nx, mode);
+        return;
+    }
+    if( !blur_x )
+    {
+        fast_gaussian_blur_vertical<T,P>(in, out, w, h, c, sigma_y, ny, mode);
+        return;
+    }
+    if( c < 1 || c > 4 )
+    {
+        printf("fast_gaussian_blur over %d channels is not supported yet. Add a specific case if possible or fall back to the generic version.\n", c);
+        return;
+    }
+
+    // Mặc định: đồ thị task theo band (blur_graph), nhận mọi n >= 1. Chế độ NUMA giữ pipeline
+    // chia dải tĩnh theo thread (các phiên bản theo N bên dưới) để trang nhớ luôn là local.
+    const BlurPlan & plan = blur_plan();
+    if( plan.numa_bands && nx == ny )
+    {
+        FGB_STATS_CALL(worker_count());
+
+        // Dispatch theo số passes để gọi phiên bản template tối ưu tương ứng
+        switch(nx)
+        {
+            case 1: fast_gaussian_blur<T,1,P>(in, out, w, h, c, sigma_x, sigma_y, mode); break;
+            case 2: fast_gaussian_blur<T,2,P>(in, out, w, h, c, sigma_x, sigma_y, mode); break;
+            case 3: fast_gaussian_blur<T,  P>(in, out, w, h, c, sigma_x, sigma_y, mode); break; // Phiên bản chuyên biệt cho 3 passes (tối ưu nhất)
+            case 4: fast_gaussian_blur<T,4,P>(in, out, w, h, c, sigma_x, sigma_y, mode); break;
+            case 5: fast_gaussian_blur<T,5,P>(in, out, w, h, c, sigma_x, sigma_y, mode); break;
+            case 6: fast_gaussian_blur<T,6,P>(in, out, w, h, c, sigma_x, sigma_y, mode); break;
+            case 7: fast_gaussian_blur<T,7,P>(in, out, w, h, c, sigma_x, sigma_y, mode); break;
+            case 8: fast_gaussian_blur<T,8,P>(in, out, w, h, c, sigma_x, sigma_y, mode); break;
+            case 9: fast_gaussian_blur<T,9,P>(in, out, w, h, c, sigma_x, sigma_y, mode); break;
+            case 10: fast_gaussian_blur<T,10,P>(in, out, w, h, c, sigma_x, sigma_y, mode); break;
+            default: printf("fast_gaussian_blur with %u passes is not supported yet. Add a specific case if possible or fall back to the generic version.\n", nx); break;
+            // default: fast_gaussian_blur<T,10>(in, out, w, h, c, sigma, n); break;
+        }
+        return;
+    }
+
+    // Chuỗi box của từng chiều
+    std::vector<int> hboxes(nx), vboxes(ny);
+    std::vector<float> halphas(nx), valphas(ny);
+    sigma_to_boxes(hboxes.data(), halphas.data(), sigma_x, int(nx), mode);
+    sigma_to_boxes(vboxes.data(), valphas.data(), sigma_y, int(ny), mode);
+    const BoxPasses horizontal = { hboxes.data(), halphas.data(), int(nx) };
+    const BoxPasses vertical = { vboxes.data(), valphas.data(), int(ny) };
+
+    // Số worker theo mô hình chi phí: ảnh nhỏ (thumbnail, dải hẹp) chạy trên ít thread hơn,
+    // xuống tới 1 (khi đó không đánh thức backend)
+    double pass_units = 0;
+    for(const int r : hboxes)
+        pass_units += r < w/2 ? 1 : 2;
+    for(const int r : vboxes)
+        pass_units += r < h/2 ? 1 : 2;
+    const int workers = plan.threads_for(double(w)*h*c, pass_units, 2, worker_count());
+    FGB_STATS_CALL(workers);
+
+    const bool stream = plan.stream_output(w, h);
+    switch(c)
+    {
+        case 1: blur_graph<T,1,P>(in, out, w, h, horizontal, vertical, stream, workers); break;
+        case 2: blur_graph<T,2,P>(in, out, w, h, horizontal, vertical, stream, workers); break;
+        case 3: blur_graph<T,3,P>(in, out, w, h, horizontal, vertical, stream, workers); break;
+        case 4: blur_graph<T,4,P>(in, out, w, h, horizontal, vertical, stream, workers); break;
+    }
+}
+
+//!
+//! \brief Hàm dispatcher template cho fast_gaussian_blur. Template hóa theo kiểu dữ liệu T và border policy P.
+//! Cùng sigma và số passes n cho hai chiều (xem phiên bản bất đẳng hướng ở trên).
+//!
+//! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn (sẽ bị sửa đổi)
+//! \param[in,out] out      Con trỏ tham chiếu đến buffer đích (sẽ bị sửa đổi)
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] sigma        Độ lệch chuẩn Gaussian (Gaussian standard deviation)
+//! \param[in] n            Số lần passes, nên > 0 (number of passes, should be > 0)
+//! \param[in] mode         Cách xấp xỉ sigma bằng box, mặc định = kBoxInteger
+//!
+template<typename T, Border P = kMirror>
+void fast_gaussian_blur(T *& in, T *& out, const int w, const int h, const int c, const float sigma, const uint32_t n, const BoxMode mode = kBoxInteger)
+{
+    fast_gaussian_blur<T,P>(in, out, w, h, c, sigma, sigma, n, n, mode);
+}
+
+//!
+//! \brief Hàm dispatcher template chính cho fast_gaussian_blur. Template hóa theo kiểu dữ liệu buffer T.
+//! Đây là hàm chính được expose và nên được sử dụng trong các chương trình.
+//!
+//! Hàm này dispatch theo border policy để gọi hàm fast_gaussian_blur tương ứng.
+//! Đây là entry point cuối cùng, nhận tất cả các tham số bao gồm border policy.
+//!
+//! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn (sẽ bị sửa đổi)
+//! \param[in,out] out      Con trỏ tham chiếu đến buffer đích (sẽ bị sửa đổi)
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] sigma        Độ lệch chuẩn Gaussian (Gaussian standard deviation)
+//! \param[in] n            Số lần passes, mặc định = 3 (number of passes, default = 3)
+//! \param[in] p            Chính sách xử lý biên: {kExtend, kMirror, kKernelCrop, kWrap}, mặc định = kExtend
+//! \param[in] mode         Cách xấp xỉ sigma: {kBoxInteger, kBoxExtended}, mặc định = kBoxInteger
+//!
+template<typename T>
+void fast_gaussian_blur(
+    T *& in,
+    T *& out,
+    const int w,
+    const int h,
+    const int c,
+    const float sigma,
+    const uint32_t n = 3,
+    const Border p = kExtend,
+    const BoxMode mode = kBoxInteger)
+{
+    // Dispatch theo border policy để gọi hàm fast_gaussian_blur tương ứng
+    switch(p)
+    {
+        case kExtend:       fast_gaussian_blur<T, kExtend>       (in, out, w, h, c, sigma, n, mode); break;
+        case kMirror:       fast_gaussian_blur<T, kMirror>       (in, out, w, h, c, sigma, n, mode); break;
+        case kKernelCrop:   fast_gaussian_blur<T, kKernelCrop>   (in, out, w, h, c, sigma, n, mode); break;
+        case kWrap:         fast_gaussian_blur<T, kWrap>         (in, out, w, h, c, sigma, n, mode); break;
+    }
+}
+
+//!
+//! \brief Phiên bản bất đẳng hướng của entry point chính: sigma và số passes riêng cho từng chiều
+//! (xấp xỉ motion blur, cảm biến có pixel không vuông). Chiều có sigma bằng 0 được bỏ qua cùng với
+//! cả hai lần chuyển vị, nên blur một chiều chỉ tốn các pass của chiều đó.
+//!
+//! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn (sẽ bị sửa đổi)
+//! \param[in,out] out      Con trỏ tham chiếu đến buffer đích (sẽ bị sửa đổi)
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] sigma_x      Độ lệch chuẩn Gaussian theo chiều ngang, 0 để không blur ngang
+//! \param[in] sigma_y      Độ lệch chuẩn Gaussian theo chiều dọc, 0 để không blur dọc
+//! \param[in] nx           Số passes theo chiều ngang
+//! \param[in] ny           Số passes theo chiều dọc
+//! \param[in] p            Chính sách xử lý biên: {kExtend, kMirror, kKernelCrop, kWrap}, mặc định = kExtend
+//! \param[in] mode         Cách xấp xỉ sigma: {kBoxInteger, kBoxExtended}, mặc định = kBoxInteger
+//!
+template<typename T>
+void fast_gaussian_blur(
+    T *& in,
+    T *& out,
+    const int w,
+    const int h,
+    const int c,
+    const float sigma_x,
+    const float sigma_y,
+    const uint32_t nx,
+    const uint32_t ny,
+    const Border p = kExtend,
+    const BoxMode mode = kBoxInteger)
+{
+    switch(p)
+    {
+        case kExtend:       fast_gaussian_blur<T, kExtend>       (in, out, w, h, c, sigma_x, sigma_y, nx, ny, mode); break;
+        case kMirror:       fast_gaussian_blur<T, kMirror>       (in, out, w, h, c, sigma_x, sigma_y, nx, ny, mode); break;
+        case kKernelCrop:   fast_gaussian_blur<T, kKernelCrop>   (in, out, w, h, c, sigma_x, sigma_y, nx, ny, mode); break;
+        case kWrap:         fast_gaussian_blur<T, kWrap>         (in, out, w, h, c, sigma_x, sigma_y, nx, ny, mode); break;
+    }
+}
+
+//!
+//! \brief Entry point chính của blur một chiều theo hàng (xem fast_gaussian_blur_horizontal<T,P>):
+//! không chuyển vị, không pass dọc. Kết quả nằm trong out, in không bị sửa.
+//!
+//! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn
+//! \param[in,out] out      Con trỏ tham chiếu đến buffer đích
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] sigma        Độ lệch chuẩn Gaussian theo chiều ngang
+//! \param[in] n            Số lần passes, mặc định = 3
+//! \param[in] p            Chính sách xử lý biên: {kExtend, kMirror, kKernelCrop, kWrap}, mặc định = kExtend
+//! \param[in] mode         Cách xấp xỉ sigma: {kBoxInteger, kBoxExtended}, mặc định = kBoxInteger
+//!
+template<typename T>
+void fast_gaussian_blur_horizontal(
+    T *& in,
+    T *& out,
+    const int w,
+    const int h,
+    const int c,
+    const float sigma,
+    const uint32_t n = 3,
+    const Border p = kExtend,
+    const BoxMode mode = kBoxInteger)
+{
+    switch(p)
+    {
+        case kExtend:       fast_gaussian_blur_horizontal<T, kExtend>       (in, out, w, h, c, sigma, n, mode); break;
+        case kMirror:       fast_gaussian_blur_horizontal<T, kMirror>       (in, out, w, h, c, sigma, n, mode); break;
+        case kKernelCrop:   fast_gaussian_blur_horizontal<T, kKernelCrop>   (in, out, w, h, c, sigma, n, mode); break;
+        case kWrap:         fast_gaussian_blur_horizontal<T, kWrap>         (in, out, w, h, c, sigma, n, mode); break;
+    }
+}
+
+//!
+//! \brief Entry point chính của blur một chiều theo cột (xem fast_gaussian_blur_vertical<T,P>):
+//! các pass dọc chạy trên dải cột, không chuyển vị. in được dùng làm buffer tạm, kết quả nằm trong out.
+//!
+//! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn (sẽ bị sửa đổi)
+//! \param[in,out] out      Con trỏ tham chiếu đến buffer đích (sẽ bị sửa đổi)
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] sigma        Độ lệch chuẩn Gaussian theo chiều dọc
+//! \param[in] n            Số lần passes, mặc định = 3
+//! \param[in] p            Chính sách xử lý biên: {kExtend, kMirror, kKernelCrop, kWrap}, mặc định = kExtend
+//! \param[in] mode         Cách xấp xỉ sigma: {kBoxInteger, kBoxExtended}, mặc định = kBoxInteger
+//!
+template<typename T>
+void fast_gaussian_blur_vertical(
+    T *& in,
+    T *& out,
+    const int w,
+    const int h,
+    const int c,
+    const float sigma,
+    const uint32_t n = 3,
+    const Border p = kExtend,
+    const BoxMode mode = kBoxInteger)
+{
+    switch(p)
+    {
+        case kExtend:       fast_gaussian_blur_vertical<T, kExtend>       (in, out, w, h, c, sigma, n, mode); break;
+        case kMirror:       fast_gaussian_blur_vertical<T, kMirror>       (in, out, w, h, c, sigma, n, mode); break;
+        case kKernelCrop:   fast_gaussian_blur_vertical<T, kKernelCrop>   (in, out, w, h, c, sigma, n, mode); break;
+        case kWrap:         fast_gaussian_blur_vertical<T, kWrap>         (in, out, w, h, c, sigma, n, mode); break;
+    }
+}
+
+// ================================================================
+// BLUR KẾT HỢP LẤY MẪU THƯA (DECIMATION)
+// ================================================================
+//
+// Tạo thumbnail bằng blur ở độ phân giải đầy đủ rồi lấy mẫu thưa bỏ đi 75-94% số pixel đã tính.
+// Ở đây pass cuối của mỗi chiều chỉ tính và ghi mỗi mẫu thứ factor (horizontal_blur_extended với
+// step): cửa sổ trượt vẫn đi qua mọi pixel vào, nhưng số byte ghi của pass cuối và cả hai lần
+// chuyển vị giảm factor lần so với blur thường.
+//
+// - pass ngang  : in (h hàng dài w) -> tạm (h hàng dài ow), các pass trước pass cuối chạy trong band
+// - chuyển vị   : tạm -> in (ow hàng dài h), in không còn được đọc nên dùng làm buffer tạm
+// - pass dọc    : in -> tạm (ow hàng dài oh)
+// - chuyển vị   : tạm -> out (oh hàng dài ow)
+// Mọi giai đoạn, kể cả hai lần chuyển vị (flip_block_workers), chạy trên workers worker qua run_workers.
+//
+
+//!
+//! \brief Blur rồi lấy mẫu thưa factor lần mỗi chiều: out nhận ảnh (w+factor-1)/factor x
+//! (h+factor-1)/factor gồm các pixel (x*factor, y*factor) của ảnh đã blur. in bị ghi đè.
+//!
+template<typename T, int C, Border P>
+inline void blur_decimated(T * in, T * out, const int w, const int h, const BoxPasses & box, const int factor, const int workers)
+{
+    const int ow = (w + factor-1)/factor, oh = (h + factor-1)/factor;
+    // Ảnh trung gian cỡ ảnh nên cấp phát theo lần gọi, không chạm trước: mỗi trang được chạm lần
+    // đầu bởi worker ghi band của nó trong pass ngang
+    T * tmp = first_touch_alloc<T>(std::size_t(h)*ow*C, false);
+    if( !tmp )
+    {
+        printf("blur_decimated: cannot allocate the %dx%d intermediate image.\n", ow, h);
+        return;
+    }
+
+    blur_rows<T,C,P>(in, tmp, w, h, box, workers, factor);
+    flip_block_workers<T,C>(tmp, in, ow, h, false, workers, kStageFlip);
+    blur_rows<T,C,P>(in, tmp, h, ow, box, workers, factor);
+    flip_block_workers<T,C>(tmp, out, oh, ow, blur_plan().stream_output(ow, oh), workers, kStageFlipBack);
+    first_touch_free(tmp);
+}
+
+//!
+//! \brief Fast Gaussian Blur kết hợp lấy mẫu thưa (thumbnail). Template hóa theo kiểu dữ liệu T và
+//! border policy P. Kết quả là ảnh (w+factor-1)/factor x (h+factor-1)/factor trong out, xấp xỉ các
+//! pixel (x*factor, y*factor) của fast_gaussian_blur với cùng tham số: cùng chuỗi box, nhưng pass
+//! cuối mỗi chiều có phép tính riêng (horizontal_blur_extended với step) nên không bảo đảm giống
+//! từng bit (với float có thể lệch ở mức làm tròn). sigma <= 0 hoặc n == 0: chỉ lấy mẫu thưa.
+//! factor <= 1: fast_gaussian_blur thường.
+//!
+//! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn (sẽ bị sửa đổi)
+//! \param[in,out] out      Con trỏ tham chiếu đến buffer đích, ít nhất (w+factor-1)/factor * (h+factor-1)/factor * c phần tử
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] sigma        Độ lệch chuẩn Gaussian, theo pixel của ảnh gốc
+//! \param[in] factor       Hệ số lấy mẫu thưa mỗi chiều
+//! \param[in] n            Số lần passes
+//! \param[in] mode         Cách xấp xỉ sigma bằng box
+//!
+template<typename T, Border P>
+void fast_gaussian_blur_decimate(T *& in, T *& out, const int w, const int h, const int c, const float sigma, const int factor, const uint32_t n, const BoxMode mode)
+{
+    if( factor <= 1 )
+    {
+        fast_gaussian_blur<T,P>(in, out, w, h, c, sigma, n, mode);
+        return;
+    }
+
+    // Không blur: một pass box bán kính 0 (đồng nhất) vẫn lấy mẫu thưa
+    const bool blur = n >= 1 && sigma > 0.f;
+    const int passes = blur ? int(n) : 1;
+    std::vector<int> boxes(passes, 0);
+    std::vector<float> alphas(passes, 0.f);
+    if( blur )
+        sigma_to_boxes(boxes.data(), alphas.data(), sigma, passes, mode);
+    const BoxPasses box = { boxes.data(), alphas.data(), passes };
+
+    double pass_units = 0;
+    for(const int r : boxes)
+        pass_units += (r < w/2 ? 1 : 2) + (r < h/2 ? 1 : 2);
+    const int workers = blur_plan().threads_for(double(w)*h*c, pass_units, 2, worker_count());
+    FGB_STATS_CALL(workers);
+
+    switch(c)
+    {
+        case 1: blur_decimated<T,1,P>(in, out, w, h, box, factor, workers); break;
+        case 2: blur_decimated<T,2,P>(in, out, w, h, box, factor, workers); break;
+        case 3: blur_decimated<T,3,P>(in, out, w, h, box, factor, workers); break;
+        case 4: blur_decimated<T,4,P>(in, out, w, h, box, factor, workers); break;
+        default: printf("fast_gaussian_blur_decimate over %d channels is not supported yet. Add a specific case if possible or fall back to the generic version.\n", c); break;
+    }
 }
 
 //!
-//! \brief Hàm này thực hiện Fast Gaussian Blur. Được template hóa theo kiểu dữ liệu T và số passes N.
+//! \brief Entry point của blur kết hợp lấy mẫu thưa (xem fast_gaussian_blur_decimate<T,P>).
 //!
-//! Áp dụng nhiều lần box blur sẽ hội tụ về một Gaussian blur thật sự (nhờ định lý Central Limit).
-//! Ba passes là đủ để có kết quả tốt. Buffer input cũng được dùng làm temporary và bị sửa đổi
-//! trong quá trình xử lý nên không thể là const.
+//! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn (sẽ bị sửa đổi)
+//! \param[in,out] out      Con trỏ tham chiếu đến buffer đích, ít nhất (w+factor-1)/factor * (h+factor-1)/factor * c phần tử
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] sigma        Độ lệch chuẩn Gaussian, theo pixel của ảnh gốc
+//! \param[in] factor       Hệ số lấy mẫu thưa mỗi chiều
+//! \param[in] n            Số lần passes, mặc định = 3
+//! \param[in] p            Chính sách xử lý biên: {kExtend, kMirror, kKernelCrop, kWrap}, mặc định = kExtend
+//! \param[in] mode         Cách xấp xỉ sigma: {kBoxInteger, kBoxExtended}, mặc định = kBoxInteger
 //!
-//! Thông thường quá trình nên luân phiên giữa horizontal và vertical passes
-//! với số lần tương ứng với số box blur passes mong muốn. Tuy nhiên nhờ tính chất của box blur,
-//! các passes có thể tách biệt (separable) có thể thực hiện theo bất kỳ thứ tự nào mà không thay đổi kết quả.
-//! Vì lý do hiệu năng, thuật toán được tối ưu như sau:
-//! - Áp dụng N lần horizontal blur (horizontal passes)
-//! - Chuyển vị buffer ảnh (transposition) - biến horizontal thành vertical
-//! - Áp dụng N lần horizontal blur (thực chất là vertical passes trên ảnh đã transpose)
-//! - Chuyển vị lại buffer ảnh (transposition) - trả về dạng ban đầu
+template<typename T>
+void fast_gaussian_blur_decimate(
+    T *& in,
+    T *& out,
+    const int w,
+    const int h,
+    const int c,
+    const float sigma,
+    const int factor,
+    const uint32_t n = 3,
+    const Border p = kExtend,
+    const BoxMode mode = kBoxInteger)
+{
+    switch(p)
+    {
+        case kExtend:       fast_gaussian_blur_decimate<T, kExtend>       (in, out, w, h, c, sigma, factor, n, mode); break;
+        case kMirror:       fast_gaussian_blur_decimate<T, kMirror>       (in, out, w, h, c, sigma, factor, n, mode); break;
+        case kKernelCrop:   fast_gaussian_blur_decimate<T, kKernelCrop>   (in, out, w, h, c, sigma, factor, n, mode); break;
+        case kWrap:         fast_gaussian_blur_decimate<T, kWrap>         (in, out, w, h, c, sigma, factor, n, mode); break;
+    }
+}
+
+// ================================================================
+// SIGMA THAY ĐỔI THEO PIXEL (PREFIX SUMS)
+// ================================================================
+//
+// Với depth-of-field hay foveated rendering, sigma được cho theo từng pixel (sigma map) nên không
+// dùng được cửa sổ trượt bán kính cố định. Mỗi hàng được tích lũy thành prefix sum (integral image
+// một chiều) trên hàng đã mở rộng theo border policy: tổng của box bất kỳ quanh pixel x là hiệu
+// của hai phần tử, O(1) với mọi bán kính. Bán kính của mỗi pixel là extended box (bán kính liên tục
+// r + alpha, xem extended_box) nên sigma thay đổi liên tục mà không tạo vệt ở chỗ bán kính đổi.
+// Pipeline giống phiên bản tĩnh: N pass ngang, chuyển vị, N pass dọc (prefix sum theo cột của ảnh
+// gốc), chuyển vị ngược. Mọi giai đoạn chạy qua run_workers (band theo ticket, như blur_rows) nên
+// theo backend đang chọn và số worker của mô hình chi phí. Bản đồ bán kính chỉ tồn tại theo band,
+// trong band_scratch: band dọc đọc thẳng các cột tương ứng của sigma map, không cần chuyển vị.
+//
+
 //!
-//! Có hai phiên bản của hàm:
-//! - Generic N passes (dùng nhiều std::swap hơn)
-//! - Specialized 3 passes (tối ưu riêng cho 3 passes)
+//! \brief Bản đồ bán kính liên tục r + alpha (extended box của mỗi pass) từ sigma map, cho count
+//! phần tử liên tiếp. radius có thể trùng sigma (tính tại chỗ).
 //!
-//! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn (sẽ bị sửa đổi)
-//! \param[in,out] out      Con trỏ tham chiếu đến buffer đích (sẽ bị sửa đổi)
-//! \param[in] w            Chiều rộng ảnh
-//! \param[in] h            Chiều cao ảnh
-//! \param[in] c            Số kênh màu
-//! \param[in] sigma        Độ lệch chuẩn Gaussian
+inline void varying_radius(const float * sigma, float * radius, const std::size_t count, const int n)
+{
+    // Công thức của extended_box viết bằng float, không rẽ nhánh để compiler vector hóa vòng lặp
+    // (biểu thức bên trong không âm nên ép kiểu int chính là floor). r + alpha liên tục theo phương
+    // sai nên sai số làm tròn ở biên giữa hai bán kính nguyên không gây bước nhảy.
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        const float variance = sigma[i]*sigma[i]/n;
+        const float r = float(int(0.5f*std::sqrt(12*variance + 1) - 0.5f));
+        const float alpha = (2*r+1)*(variance - r*(r+1)/3) / (2*((r+1)*(r+1) - variance));
+        radius[i] = r + std::min(std::max(alpha, 0.f), 1.f);
+    }
+}
+
 //!
-template<typename T, unsigned int N, Border P>
-inline void fast_gaussian_blur(T *& in, T *& out, const int w, const int h, const int c, const float sigma) 
+//! \brief Một box pass ngang với bán kính riêng cho từng pixel: prefix sum của hàng mở rộng theo
+//! border policy P, rồi mỗi pixel lấy hiệu hai phần tử cho phần nguyên của box và hai tap đầu có
+//! trọng số alpha (như horizontal_blur_extended). Tổng tích lũy dùng int64 (kiểu nguyên) hoặc double.
+//!
+//! \param[in] in           Buffer ảnh nguồn (source buffer)
+//! \param[in,out] out      Buffer ảnh đích (target buffer)
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Số hàng cần xử lý
+//! \param[in] radius       Bán kính liên tục r + alpha của từng pixel, w*h phần tử
+//!
+template<typename T, int C, Border P>
+inline void horizontal_blur_varying(const T * in, T * out, const int w, const int h, const float * radius)
 {
-    // Tính toán kích thước box kernel cho mỗi pass
-    // Sử dụng công thức tối ưu để xấp xỉ Gaussian với N passes
-    int boxes[N];
-    sigma_to_box_radius(boxes, sigma, N);
+    using sum_type = std::conditional_t<std::is_integral_v<T>, int64_t, double>;
+    static const T zeros[C] = {};   // tap ngoài hàng của kKernelCrop
 
-    // ================================================================
-    // BƯỚC 1: THỰC HIỆN N LẦN HORIZONTAL BLUR PASSES
-    // ================================================================
-    // Mỗi pass sẽ được song song hóa bên trong horizontal_blur
-    // Các passes này xử lý blur theo chiều ngang của ảnh
-    for(int i = 0; i < N; ++i)
-    {
-        // Thực hiện horizontal blur với box radius boxes[i]
-        // Hàm này sử dụng OpenMP để song song hóa theo từng hàng
-        horizontal_blur<T,P>(in, out, w, h, c, boxes[i]);
-        // Hoán đổi con trỏ: output của pass này trở thành input của pass tiếp theo
-        std::swap(in, out);
-    }   
+    for(int i=0; i<h; i++)
+    {
+        const int begin = i*w, end = begin+w;
+        const float * row_radius = radius + std::size_t(i)*w;
+        const int pad = int(*std::max_element(row_radius, row_radius+w)) + 1;  // tap xa nhất: r+1
+        const int len = w + 2*pad;
+        sum_type * sums = band_scratch<sum_type>(std::size_t(len+1)*C);
 
-    // ================================================================
-    // BƯỚC 2: CHUYỂN VỊ (TRANSPOSE) BUFFER ẢNH
-    // ================================================================
-    // Transpose biến ảnh từ dạng row-major sang column-major
-    // Sau transpose: blur ngang trên ảnh gốc = blur dọc trên ảnh đã transpose
-    // Hàm flip_block cũng được song song hóa với collapse(2)
-    flip_block(in, out, w, h, c);
-    std::swap(in, out);  // Hoán đổi con trỏ sau transpose
-    
-    // ================================================================
-    // BƯỚC 3: THỰC HIỆN N LẦN HORIZONTAL BLUR TRÊN ẢNH ĐÃ TRANSPOSE
-    // ================================================================
-    // Vì ảnh đã được transpose, blur ngang trên ảnh transpose = blur dọc trên ảnh gốc
-    // Chú ý: w và h đã đổi chỗ sau transpose (w_old = h_new, h_old = w_new)
-    for(int i = 0; i < N; ++i)
+        // sums[u] = tổng các tap ở vị trí [-pad, u-pad) của hàng mở rộng
+        sum_type acc[C];
+        auto accumulate = [&](const int u, const T * pixel)
+        {
+            for(int ch=0; ch<C; ++ch)
+            {
+                acc[ch] += pixel[ch];
+                sums[(u+1)*C+ch] = acc[ch];
+            }
+        };
+        auto remapped = [&](const int j) -> const T *
+        {
+            if constexpr(P == kKernelCrop)
+                return j >= begin && j < end ? in + j*C : zeros;
+            else
+                return in + (w > 1 ? remap_index<P>(begin, end, j) : begin)*C;
+        };
+        for(int ch=0; ch<C; ++ch)
+            sums[ch] = acc[ch] = 0;
+        for(int u=0; u<pad; u++)
+            accumulate(u, remapped(begin+u-pad));
+        for(int u=pad; u<pad+w; u++)
+            accumulate(u, in + (begin+u-pad)*C);
+        for(int u=pad+w; u<len; u++)
+            accumulate(u, remapped(begin+u-pad));
+
+        for(int x=0; x<w; x++)
+        {
+            const float rf = row_radius[x];
+            const int r = int(rf);
+            const float alpha = rf - r;
+            const sum_type * lo = sums + (x-r+pad)*C;      // prefix trước vị trí x-r
+            const sum_type * hi = sums + (x+r+1+pad)*C;    // prefix trước vị trí x+r+1
+
+            float norm = 1.f / (2*rf+1);
+            if constexpr(P == kKernelCrop)
+            {
+                const int inside = std::min(w-1, x+r) - std::max(0, x-r) + 1;
+                norm = 1.f / (inside + alpha*((x-r-1 >= 0) + (x+r+1 < w)));
+            }
+            for(int ch=0; ch<C; ++ch)
+            {
+                const sum_type box = hi[ch] - lo[ch];
+                const sum_type ends = (lo[ch] - lo[ch-C]) + (hi[ch+C] - hi[ch]);   // tap x-r-1 và x+r+1
+                out[(begin+x)*C+ch] = (box + alpha*ends)*norm + round_v<T>();
+            }
+        }
+    }
+}
+
+//!
+//! \brief N pass horizontal_blur_varying trên ảnh h hàng dài w, theo band như blur_rows: mỗi worker
+//! nhận lần lượt các band bằng ticket và chạy mọi pass của band khi nó còn nóng trong cache, luân
+//! phiên src -> dst -> src ... Bán kính của band được tính vào band_scratch ngay trước pass đầu, từ
+//! sigma map (w*h, row-major) hoặc, với transposed, từ các cột của sigma map gốc (h hàng dài w là
+//! ảnh chuyển vị). Kết quả nằm trong dst nếu n lẻ, trong src nếu n chẵn.
+//!
+template<typename T, int C, Border P>
+inline void blur_rows_varying(T * src, T * dst, const int w, const int h, const float * sigma, const bool transposed, const int n, const int workers, const int stage)
+{
+    const int bh = blur_plan().band_rows((long long)w*C*sizeof(T), h);
+    const int nb = (h + bh-1)/bh;
+    std::atomic<int> ticket{0};
+    run_workers(workers, [&](int)
     {
-        // Horizontal blur trên ảnh đã transpose (thực chất là vertical blur trên ảnh gốc)
-        horizontal_blur<T,P>(in, out, h, w, c, boxes[i]);
-        std::swap(in, out);
-    }   
-    
-    // ================================================================
-    // BƯỚC 4: CHUYỂN VỊ LẠI BUFFER ẢNH
-    // ================================================================
-    // Transpose lại để trả về dạng ban đầu (row-major)
-    // Chú ý: w và h vẫn đổi chỗ vì ta đang transpose lại
-    flip_block(in, out, h, w, c);
+        float * radius = band_scratch<float>(std::size_t(bh)*w);
+        for(int b = ticket.fetch_add(1, std::memory_order_relaxed); b < nb; b = ticket.fetch_add(1, std::memory_order_relaxed))
+        {
+            const int y0 = b*bh, y1 = std::min(h, y0+bh);
+            const std::size_t offset = std::size_t(y0)*w;
+            const std::size_t count = std::size_t(y1-y0)*w;
+            if( transposed )
+            {
+                // Hàng y của ảnh chuyển vị là cột y của sigma map gốc (w hàng dài h): gom theo hàng gốc
+                // để đọc liên tiếp, ghi vào band (vừa cache) theo bước w
+                for(int x = 0; x < w; ++x)
+                    for(int y = y0; y < y1; ++y)
+                        radius[std::size_t(y-y0)*w + x] = sigma[std::size_t(x)*h + y];
+                varying_radius(radius, radius, count, n);
+            }
+            else
+                varying_radius(sigma + offset, radius, count, n);
+            FGB_STAGE(stage, 2*std::size_t(n)*(y1-y0)*w*C*sizeof(T));
+            for(int i = 0; i < n; ++i)
+                horizontal_blur_varying<T,C,P>((i%2 ? dst : src) + offset*C, (i%2 ? src : dst) + offset*C, w, y1-y0, radius);
+        }
+    });
 }
 
-// Phiên bản chuyên biệt cho 3 passes (biquadratic filter) - tối ưu hơn phiên bản generic
-// Tối ưu bằng cách giảm số lần swap và có thể được compiler optimize tốt hơn
-template<typename T, Border P>
-inline void fast_gaussian_blur(T *& in, T *& out, const int w, const int h, const int c, const float sigma) 
+//!
+//! \brief Pipeline của fast_gaussian_blur_varying trên workers worker (run_workers): N pass ngang
+//! theo band, chuyển vị, N pass dọc theo band của ảnh chuyển vị, chuyển vị ngược. Không cấp phát:
+//! bán kính nằm trong band_scratch của từng worker. 2N+2 lần ghi (số chẵn) nên kết quả nằm trong
+//! in; out bị ghi đè.
+//!
+template<typename T, int C, Border P>
+inline void blur_varying(T * in, T * out, const int w, const int h, const float * sigma, const int n, const bool stream, const int workers)
 {
-    // Tính toán kích thước box kernel cho 3 passes
-    int boxes[3];
-    sigma_to_box_radius(boxes, sigma, 3);
+    blur_rows_varying<T,C,P>(in, out, w, h, sigma, false, n, workers, kStageHorizontal);
 
-    // ================================================================
-    // BƯỚC 1: THỰC HIỆN 3 LẦN HORIZONTAL BLUR PASSES
-    // ================================================================
-    // Luân phiên sử dụng in và out để tránh copy không cần thiết
-    horizontal_blur<T,P>(in, out, w, h, c, boxes[0]);  // Pass 1: in -> out
-    horizontal_blur<T,P>(out, in, w, h, c, boxes[1]);  // Pass 2: out -> in (đảo ngược)
-    horizontal_blur<T,P>(in, out, w, h, c, boxes[2]);  // Pass 3: in -> out
-    
-    // ================================================================
-    // BƯỚC 2: CHUYỂN VỊ (TRANSPOSE) BUFFER ẢNH
-    // ================================================================
-    // Chuyển vị ảnh: out (chứa kết quả 3 passes ngang) -> in (sẽ làm input cho passes dọc)
-    flip_block(out, in, w, h, c);
-    
-    // ================================================================
-    // BƯỚC 3: THỰC HIỆN 3 LẦN HORIZONTAL BLUR TRÊN ẢNH ĐÃ TRANSPOSE
-    // ================================================================
-    // Blur ngang trên ảnh transpose = blur dọc trên ảnh gốc
-    // Chú ý: w và h đã đổi chỗ (w_old = h_new, h_old = w_new)
-    horizontal_blur<T,P>(in, out, h, w, c, boxes[0]);  // Pass 1 (dọc): in -> out
-    horizontal_blur<T,P>(out, in, h, w, c, boxes[1]);  // Pass 2 (dọc): out -> in
-    horizontal_blur<T,P>(in, out, h, w, c, boxes[2]);  // Pass 3 (dọc): in -> out
-    
-    // ================================================================
-    // BƯỚC 4: CHUYỂN VỊ LẠI BUFFER ẢNH
-    // ================================================================
-    // Transpose lại để trả về dạng ban đầu
-    flip_block(out, in, h, w, c);
-    
-    // Hoán đổi con trỏ để kết quả cuối cùng nằm trong buffer out
-    std::swap(in, out);    
+    // Pass dọc là pass ngang trên ảnh chuyển vị
+    T * rows = n%2 ? out : in;
+    T * cols = n%2 ? in : out;
+    flip_block_workers<T,C>(rows, cols, w, h, false, workers, kStageFlip);
+
+    // Kết quả của các pass dọc luôn nằm trong out (rows nếu n lẻ, cols nếu n chẵn)
+    blur_rows_varying<T,C,P>(cols, rows, h, w, sigma, true, n, workers, kStageVertical);
+    flip_block_workers<T,C>(out, in, h, w, stream, workers, kStageFlipBack);
 }
 
 //!
-//! \brief Hàm dispatcher template cho fast_gaussian_blur. Template hóa theo kiểu dữ liệu T và border policy P.
-//! Đây là hàm chính được expose và nên được sử dụng trong các chương trình.
-//!
-//! Hàm này chọn phiên bản fast_gaussian_blur phù hợp dựa trên số passes n.
-//! Việc dispatch này giúp compiler có thể inline và optimize tốt hơn.
+//! \brief Fast Gaussian Blur với sigma riêng cho từng pixel (depth-of-field, foveated rendering).
+//! Template hóa theo kiểu dữ liệu T và border policy P. Mỗi pixel được blur bởi N extended box có
+//! tổng phương sai đúng bằng sigma[pixel]^2 theo mỗi chiều; sigma = 0 giữ nguyên pixel.
 //!
 //! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn (sẽ bị sửa đổi)
 //! \param[in,out] out      Con trỏ tham chiếu đến buffer đích (sẽ bị sửa đổi)
 //! \param[in] w            Chiều rộng ảnh (image width)
 //! \param[in] h            Chiều cao ảnh (image height)
 //! \param[in] c            Số kênh màu (image channels)
-//! \param[in] sigma        Độ lệch chuẩn Gaussian (Gaussian standard deviation)
-//! \param[in] n            Số lần passes, nên > 0 (number of passes, should be > 0)
+//! \param[in] sigma        Sigma map: độ lệch chuẩn Gaussian của từng pixel, w*h phần tử row-major
+//! \param[in] n            Số lần passes mỗi chiều
 //!
-template<typename T, Border P = kMirror>
-void fast_gaussian_blur(T *& in, T *& out, const int w, const int h, const int c, const float sigma, const uint32_t n)
+template<typename T, Border P>
+void fast_gaussian_blur_varying(T *& in, T *& out, const int w, const int h, const int c, const float * sigma, const uint32_t n)
 {
-    // Dispatch theo số passes để gọi phiên bản template tối ưu tương ứng
-    switch(n)
+    if( n < 1 )
+    {
+        std::swap(in, out);
+        return;
+    }
+
+    // Số worker theo mô hình chi phí như blur_graph. Mỗi pass (prefix sum rồi hiệu hai phần tử) được
+    // tính như pass box bán kính lớn (2 đơn vị), mỗi chiều
+    const int workers = blur_plan().threads_for(double(w)*h*c, 4.0*n, 2, worker_count());
+    FGB_STATS_CALL(workers);
+
+    const bool stream = blur_plan().stream_output(w, h);
+    switch(c)
     {
-        case 1: fast_gaussian_blur<T,1,P>(in, out, w, h, c, sigma); break;
-        case 2: fast_gaussian_blur<T,2,P>(in, out, w, h, c, sigma); break;
-        case 3: fast_gaussian_blur<T,  P>(in, out, w, h, c, sigma); break; // Phiên bản chuyên biệt cho 3 passes (tối ưu nhất)
-        case 4: fast_gaussian_blur<T,4,P>(in, out, w, h, c, sigma); break;
-        case 5: fast_gaussian_blur<T,5,P>(in, out, w, h, c, sigma); break;
-        case 6: fast_gaussian_blur<T,6,P>(in, out, w, h, c, sigma); break;
-        case 7: fast_gaussian_blur<T,7,P>(in, out, w, h, c, sigma); break;
-        case 8: fast_gaussian_blur<T,8,P>(in, out, w, h, c, sigma); break;
-        case 9: fast_gaussian_blur<T,9,P>(in, out, w, h, c, sigma); break;
-        case 10: fast_gaussian_blur<T,10,P>(in, out, w, h, c, sigma); break;
-        default: printf("fast_gaussian_blur with %d passes is not supported yet. Add a specific case if possible or fall back to the generic version.\n", n); break;
-        // default: fast_gaussian_blur<T,10>(in, out, w, h, c, sigma, n); break;
+        case 1: blur_varying<T,1,P>(in, out, w, h, sigma, int(n), stream, workers); break;
+        case 2: blur_varying<T,2,P>(in, out, w, h, sigma, int(n), stream, workers); break;
+        case 3: blur_varying<T,3,P>(in, out, w, h, sigma, int(n), stream, workers); break;
+        case 4: blur_varying<T,4,P>(in, out, w, h, sigma, int(n), stream, workers); break;
+        default: printf("fast_gaussian_blur_varying over %d channels is not supported yet. Add a specific case if possible or fall back to the generic version.\n", c); return;
     }
+
+    // Kết quả nằm ở buffer in ban đầu, hoán đổi để nó nằm trong out
+    std::swap(in, out);
 }
 
 //!
-//! \brief Hàm dispatcher template chính cho fast_gaussian_blur. Template hóa theo kiểu dữ liệu buffer T.
-//! Đây là hàm chính được expose và nên được sử dụng trong các chương trình.
-//!
-//! Hàm này dispatch theo border policy để gọi hàm fast_gaussian_blur tương ứng.
-//! Đây là entry point cuối cùng, nhận tất cả các tham số bao gồm border policy.
+//! \brief Entry point của blur với sigma theo pixel (xem fast_gaussian_blur_varying<T,P>).
 //!
 //! \param[in,out] in       Con trỏ tham chiếu đến buffer nguồn (sẽ bị sửa đổi)
 //! \param[in,out] out      Con trỏ tham chiếu đến buffer đích (sẽ bị sửa đổi)
 //! \param[in] w            Chiều rộng ảnh (image width)
 //! \param[in] h            Chiều cao ảnh (image height)
 //! \param[in] c            Số kênh màu (image channels)
-//! \param[in] sigma        Độ lệch chuẩn Gaussian (Gaussian standard deviation)
-//! \param[in] n            Số lần passes, mặc định = 3 (number of passes, default = 3)
+//! \param[in] sigma        Sigma map: độ lệch chuẩn Gaussian của từng pixel, w*h phần tử row-major
+//! \param[in] n            Số lần passes, mặc định = 3
 //! \param[in] p            Chính sách xử lý biên: {kExtend, kMirror, kKernelCrop, kWrap}, mặc định = kExtend
 //!
 template<typename T>
-void fast_gaussian_blur(
+void fast_gaussian_blur_varying(
     T *& in,
     T *& out,
     const int w,
     const int h,
     const int c,
-    const float sigma,
+    const float * sigma,
     const uint32_t n = 3,
     const Border p = kExtend)
 {
-    // Dispatch theo border policy để gọi hàm fast_gaussian_blur tương ứng
     switch(p)
     {
-        case kExtend:       fast_gaussian_blur<T, kExtend>       (in, out, w, h, c, sigma, n); break;
-        case kMirror:       fast_gaussian_blur<T, kMirror>       (in, out, w, h, c, sigma, n); break;
-        case kKernelCrop:   fast_gaussian_blur<T, kKernelCrop>   (in, out, w, h, c, sigma, n); break;
-        case kWrap:         fast_gaussian_blur<T, kWrap>         (in, out, w, h, c, sigma, n); break;
+        case kExtend:       fast_gaussian_blur_varying<T, kExtend>       (in, out, w, h, c, sigma, n); break;
+        case kMirror:       fast_gaussian_blur_varying<T, kMirror>       (in, out, w, h, c, sigma, n); break;
+        case kKernelCrop:   fast_gaussian_blur_varying<T, kKernelCrop>   (in, out, w, h, c, sigma, n); break;
+        case kWrap:         fast_gaussian_blur_varying<T, kWrap>         (in, out, w, h, c, sigma, n); break;
+    }
+}
+
+// ================================================================
+// PYRAMID GAUSSIAN (MULTI-SCALE)
+// ================================================================
+//
+// Trích xuất đặc trưng (SIFT, scale space) cần các mức blur sigma_i = sigma0 * k^i. Các mức được
+// dựng nối tiếp: phương sai của các Gaussian cộng lại nên mức i là mức i-1 blur thêm
+// sqrt(sigma_i^2 - sigma_{i-1}^2), thay vì blur ảnh gốc với sigma_i. Khi decimate, mức đầu của
+// mỗi octave (sigma gấp đôi mức đầu octave trước) được dựng từ mức trước đã lấy mẫu 1/2 mỗi chiều,
+// nên cả octave sau chỉ tốn 1/4 octave trước. Mọi mức và buffer tạm nằm trong một arena duy nhất,
+// được giữ lại (không cấp phát) khi dựng lại pyramid cùng kích thước.
+//
+// Mỗi mức là một pass ngang (fast_gaussian_blur_horizontal, đọc mức trước mà không sửa) rồi một
+// pass dọc trên dải cột (fast_gaussian_blur_vertical), không chuyển vị.
+//
+
+//! Một mức của pyramid
+template<typename T>
+struct PyramidLevel
+{
+    T * data;       //!< ảnh của mức, nằm trong arena của pyramid
+    int w, h;       //!< kích thước của mức
+    int scale;      //!< hệ số decimation so với ảnh gốc (1, 2, 4, ...)
+    float sigma;    //!< sigma tích lũy, tính theo pixel của ảnh gốc
+};
+
+//! Pyramid Gaussian: các mức và arena chứa chúng (sao chép pyramid thì data vẫn trỏ vào arena cũ)
+template<typename T>
+struct GaussianPyramid
+{
+    std::vector<PyramidLevel<T>> levels;
+    std::vector<T> arena;
+};
+
+//! Lấy mẫu 1/2 mỗi chiều (giữ pixel chẵn): w x h -> (w+1)/2 x (h+1)/2. Các band hàng đích được chia
+//! cho các worker bằng ticket qua run_workers (như blur_rows), số worker theo mô hình chi phí.
+template<typename T>
+inline void decimate_2x(const T * in, T * out, const int w, const int h, const int c)
+{
+    const int ow = (w+1)/2, oh = (h+1)/2;
+    const int workers = blur_plan().threads_for(double(ow)*oh*c, 1, 0, worker_count());
+    const int bh = blur_plan().band_rows((long long)w*c*sizeof(T), oh);
+    const int nb = (oh + bh-1)/bh;
+    std::atomic<int> ticket{0};
+    run_workers(workers, [&](int)
+    {
+        for(int b = ticket.fetch_add(1, std::memory_order_relaxed); b < nb; b = ticket.fetch_add(1, std::memory_order_relaxed))
+            for(int y = b*bh; y < std::min(oh, (b+1)*bh); ++y)
+            {
+                const T * row = in + std::size_t(2*y)*w*c;
+                T * target = out + std::size_t(y)*ow*c;
+                for(int x = 0; x < ow; ++x)
+                    std::copy(row + std::size_t(2*x)*c, row + std::size_t(2*x+1)*c, target + std::size_t(x)*c);
+            }
+    });
+}
+
+//!
+//! \brief Dựng pyramid Gaussian. Template hóa theo kiểu dữ liệu T và border policy P.
+//! Ảnh vào được xem là chưa blur (sigma 0); mức 0 có sigma0, mức i có sigma0 * k^i (theo pixel
+//! của ảnh gốc). Với k gần 1 các bước blur nhỏ nên mode nên là kBoxExtended (sigma chính xác).
+//!
+//! \param[out] pyramid     Pyramid kết quả (arena được tái sử dụng giữa các lần gọi)
+//! \param[in] in           Ảnh nguồn, không bị sửa
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] levels       Số mức
+//! \param[in] sigma0       Sigma của mức 0
+//! \param[in] k            Tỉ lệ sigma giữa hai mức liên tiếp, > 1
+//! \param[in] decimate     Lấy mẫu 1/2 khi sigma gấp đôi mức đầu của octave hiện tại
+//! \param[in] n            Số lần passes của mỗi bước blur
+//! \param[in] mode         Cách xấp xỉ sigma bằng box
+//!
+template<typename T, Border P>
+void gaussian_pyramid(GaussianPyramid<T> & pyramid, const T * in, const int w, const int h, const int c, const int levels, const float sigma0, const float k, const bool decimate, const uint32_t n, const BoxMode mode)
+{
+    // Bố trí trước mọi mức để cấp phát arena một lần: [mức 0..L-1 | buffer tạm | ảnh decimate]
+    pyramid.levels.resize(std::max(0, levels));
+    std::vector<std::size_t> offsets(pyramid.levels.size());
+    std::vector<bool> octave_start(pyramid.levels.size(), false);
+    std::size_t size = 0;
+    int lw = w, lh = h, scale = 1;
+    float base = sigma0;
+    for(std::size_t i = 0; i < pyramid.levels.size(); ++i)
+    {
+        const float sigma = sigma0*std::pow(k, float(i));
+        if( decimate && i > 0 && sigma >= 2*base*(1-1e-4f) )
+        {
+            lw = (lw+1)/2;
+            lh = (lh+1)/2;
+            scale *= 2;
+            base = sigma;
+            octave_start[i] = true;
+        }
+        pyramid.levels[i] = { nullptr, lw, lh, scale, sigma };
+        offsets[i] = size;
+        size += std::size_t(lw)*lh*c;
+    }
+    const std::size_t image = std::size_t(w)*h*c;
+    pyramid.arena.resize(size + image + std::size_t((w+1)/2)*((h+1)/2)*c);
+    T * scratch = pyramid.arena.data() + size;
+    T * half = scratch + image;
+    for(std::size_t i = 0; i < pyramid.levels.size(); ++i)
+        pyramid.levels[i].data = pyramid.arena.data() + offsets[i];
+
+    const T * src = in;
+    int sw = w, sh = h;
+    float src_sigma = 0.f;      // sigma của src, theo pixel của mức hiện tại
+    for(std::size_t i = 0; i < pyramid.levels.size(); ++i)
+    {
+        PyramidLevel<T> & level = pyramid.levels[i];
+        if( octave_start[i] )
+        {
+            decimate_2x(src, half, sw, sh, c);
+            src = half;
+            src_sigma /= 2;
+        }
+        sw = level.w;
+        sh = level.h;
+
+        // Phương sai cộng lại: chỉ blur phần còn thiếu
+        const float target = level.sigma/level.scale;
+        const float sigma = std::sqrt(std::max(0.f, target*target - src_sigma*src_sigma));
+        if( n < 1 || !(sigma > 0.f) )
+            std::copy(src, src + std::size_t(sw)*sh*c, level.data);
+        else
+        {
+            // Pass ngang đọc src (không sửa) sang buffer sao cho pass dọc, với số pass lẻ đổi buffer
+            // còn chẵn thì không, kết thúc trong level.data
+            T * a = const_cast<T *>(src);
+            T * b = n%2 ? scratch : level.data;
+            fast_gaussian_blur_horizontal<T,P>(a, b, sw, sh, c, sigma, n, mode);
+            T * other = b == scratch ? level.data : scratch;
+            fast_gaussian_blur_vertical<T,P>(b, other, sw, sh, c, sigma, n, mode);
+        }
+        src = level.data;
+        src_sigma = target;
+    }
+}
+
+//!
+//! \brief Entry point của pyramid Gaussian (xem gaussian_pyramid<T,P>).
+//!
+//! \param[out] pyramid     Pyramid kết quả (arena được tái sử dụng giữa các lần gọi)
+//! \param[in] in           Ảnh nguồn, không bị sửa
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] levels       Số mức
+//! \param[in] sigma0       Sigma của mức 0, mặc định = 1.6
+//! \param[in] k            Tỉ lệ sigma giữa hai mức liên tiếp, mặc định = sqrt(2)
+//! \param[in] decimate     Lấy mẫu 1/2 sau mỗi octave, mặc định = true
+//! \param[in] n            Số lần passes, mặc định = 3
+//! \param[in] p            Chính sách xử lý biên: {kExtend, kMirror, kKernelCrop, kWrap}, mặc định = kExtend
+//! \param[in] mode         Cách xấp xỉ sigma: {kBoxInteger, kBoxExtended}, mặc định = kBoxExtended
+//!
+template<typename T>
+void gaussian_pyramid(
+    GaussianPyramid<T> & pyramid,
+    const T * in,
+    const int w,
+    const int h,
+    const int c,
+    const int levels,
+    const float sigma0 = 1.6f,
+    const float k = std::sqrt(2.f),
+    const bool decimate = true,
+    const uint32_t n = 3,
+    const Border p = kExtend,
+    const BoxMode mode = kBoxExtended)
+{
+    switch(p)
+    {
+        case kExtend:       gaussian_pyramid<T, kExtend>       (pyramid, in, w, h, c, levels, sigma0, k, decimate, n, mode); break;
+        case kMirror:       gaussian_pyramid<T, kMirror>       (pyramid, in, w, h, c, levels, sigma0, k, decimate, n, mode); break;
+        case kKernelCrop:   gaussian_pyramid<T, kKernelCrop>   (pyramid, in, w, h, c, levels, sigma0, k, decimate, n, mode); break;
+        case kWrap:         gaussian_pyramid<T, kWrap>         (pyramid, in, w, h, c, levels, sigma0, k, decimate, n, mode); break;
+    }
+}
+
+// ================================================================
+// API BẤT ĐỒNG BỘ (ASYNC)
+// ================================================================
+//
+// fast_gaussian_blur_async đưa lời gọi blur vào hàng đợi FIFO của một thread điều phối
+// (BlurDispatcher) và trả về ngay một std::future. Thread gọi tiếp tục decode/encode frame khác
+// trong khi blur chạy. Thread điều phối chỉ chạy một blur tại một thời điểm và blur đó dùng
+// backend đa luồng chung (blur_backend()), nên nhiều yêu cầu async không tạo thêm thread cạnh tranh CPU.
+//
+
+//! Thread điều phối: chạy lần lượt các job trong hàng đợi FIFO
+class BlurDispatcher
+{
+public:
+    BlurDispatcher() : thread([this]{ loop(); }) {}
+
+    ~BlurDispatcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        ready.notify_one();
+        thread.join();
+    }
+
+    //! Thêm job vào cuối hàng đợi
+    void submit(std::packaged_task<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(job));
+        }
+        ready.notify_one();
+    }
+
+private:
+    void loop()
+    {
+        for(;;)
+        {
+            std::packaged_task<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this]{ return stop || !queue.empty(); });
+                if( queue.empty() )
+                    return;     // stop và hàng đợi đã rỗng: các job đã nhận đều được chạy
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+            job();
+        }
     }
-}
\ No newline at end of file
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::packaged_task<void()>> queue;
+    bool stop = false;
+    std::thread thread;     // khởi tạo sau cùng: loop() dùng các thành viên ở trên
+};
+
+//! Thread điều phối dùng chung, tạo ở lần gọi async đầu tiên
+inline BlurDispatcher & blur_dispatcher()
+{
+    // Tạo pool trước để pool bị hủy sau dispatcher (static hủy theo thứ tự ngược): các job còn
+    // trong hàng đợi lúc thoát chương trình vẫn chạy trên pool còn sống
+    if( blur_backend().kind == kBackendPool )
+        blur_thread_pool();
+    static BlurDispatcher dispatcher;
+    return dispatcher;
+}
+
+//!
+//! \brief Phiên bản bất đồng bộ của fast_gaussian_blur. Các yêu cầu được thực hiện lần lượt theo
+//! thứ tự gửi. Hai buffer phải còn sống và không được đọc/ghi cho đến khi future sẵn sàng.
+//!
+//! \param[in,out] in       Buffer nguồn (sẽ bị sửa đổi)
+//! \param[in,out] out      Buffer đích (sẽ bị sửa đổi)
+//! \param[in] w            Chiều rộng ảnh (image width)
+//! \param[in] h            Chiều cao ảnh (image height)
+//! \param[in] c            Số kênh màu (image channels)
+//! \param[in] sigma        Độ lệch chuẩn Gaussian (Gaussian standard deviation)
+//! \param[in] n            Số lần passes, mặc định = 3 (number of passes, default = 3)
+//! \param[in] p            Chính sách xử lý biên, mặc định = kExtend
+//! \param[in] mode         Cách xấp xỉ sigma bằng box, mặc định = kBoxInteger
+//! \return                 Future trả về con trỏ tới buffer chứa kết quả (in hoặc out);
+//!                         exception trong lúc blur được chuyển qua future
+//!
+template<typename T>
+std::future<T *> fast_gaussian_blur_async(
+    T * in,
+    T * out,
+    const int w,
+    const int h,
+    const int c,
+    const float sigma,
+    const uint32_t n = 3,
+    const Border p = kExtend,
+    const BoxMode mode = kBoxInteger)
+{
+    auto result = std::make_shared<std::promise<T *>>();
+    std::future<T *> future = result->get_future();
+    blur_dispatcher().submit(std::packaged_task<void()>([=]() mutable
+    {
+        try
+        {
+            fast_gaussian_blur(in, out, w, h, c, sigma, n, p, mode);
+            result->set_value(out);
+        }
+        catch(...)
+        {
+            result->set_exception(std::current_exception());
+        }
+    }));
+    return future;
+}
@@ -4,10 +4,14 @@
 // Chương trình này minh họa việc sử dụng thuật toán Fast Gaussian Blur
 // được tối ưu với song song hóa (parallelization) sử dụng OpenMP.
 //
-// Chương trình sẽ chạy và so sánh cả hai phiên bản:
+// Mặc định chương trình blur ảnh một lần với toàn bộ threads.
+// Với cờ --compare, chương trình chạy và so sánh cả hai phiên bản:
 // - Có OpenMP (song song hóa)
 // - Không có OpenMP (single-threaded, dùng OMP_NUM_THREADS=1)
 //
+// Chế độ batch (--batch): blur cả thư mục ảnh qua pipeline 3 tầng
+// decode -> blur -> encode nối bằng hàng đợi giới hạn (xem run_batch)
+//
 // ================================================================
 
 #include <iostream>
@@ -16,6 +20,22 @@
 #include <string>
 #include <cmath>
 #include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <filesystem>
+#include <cctype>
+#include <cstring>
+
+// mmap cho chế độ --mmap (POSIX); Windows không có các header này, --mmap khi đó đọc/ghi qua stb
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -92,22 +112,504 @@ void print_comparison_table(double time_with_omp, double time_without_omp) {
     std::cout << "\n";
 }
 
+// ================================================================
+// HÀM TIỆN ÍCH: THAM SỐ VÀ LƯU ẢNH
+// ================================================================
+
+// Chuyển tên border policy thành enum Border (mặc định: mirror)
+Border parse_border(const std::string& policy) {
+    if (policy == "mirror")         return Border::kMirror;
+    else if (policy == "extend")    return Border::kExtend;
+    else if (policy == "crop")      return Border::kKernelCrop;
+    else if (policy == "wrap")      return Border::kWrap;
+    else                            return Border::kMirror; // Default
+}
+
+// Lưu ảnh theo phần mở rộng của file (bmp/jpg/png); định dạng khác được lưu thành png.
+// Trả về false nếu ghi thất bại
+bool save_image(std::string file, int width, int height, int channels, const uchar * data) {
+    std::string ext = file.size() >= 3 ? file.substr(file.size()-3) : "";  // Lấy phần .png/.jpg...
+
+    if( ext == "bmp" )
+        return stbi_write_bmp(file.c_str(), width, height, channels, data) != 0;
+    if( ext == "jpg" )
+        return stbi_write_jpg(file.c_str(), width, height, channels, data, 90) != 0; // chất lượng 90%
+
+    // Nếu không phải png thì chuyển về png
+    if( ext != "png" )
+    {
+        printf("Image format '%s' not supported, writing default png\n",
+               ext.c_str()); 
+        file = file.substr(0, file.size()-4) + std::string(".png");
+    }
+    return stbi_write_png(file.c_str(), width, height, channels,
+                          data, channels * width) != 0; // stride = width*channels
+}
+
+// ================================================================
+// HÀNG ĐỢI GIỚI HẠN KHÔNG KHÓA (BOUNDED MPMC QUEUE)
+// ================================================================
+// Hàng đợi vòng của Dmitry Vyukov: mỗi ô mang một số thứ tự (sequence) cho biết ô đang trống hay
+// đã có dữ liệu ở vòng hiện tại, push/pop chỉ cần một CAS trên vị trí ghi/đọc.
+// Khi hàng đợi đầy, push() chờ (back-pressure): tầng trước tự chậm lại thay vì giữ thêm ảnh
+// đã decode trong bộ nhớ.
+template<typename T>
+class BoundedQueue {
+public:
+    // capacity được làm tròn lên lũy thừa của 2
+    explicit BoundedQueue(std::size_t capacity) {
+        std::size_t size = 2;
+        while (size < capacity) size *= 2;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (std::size_t i = 0; i < size; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(T& value) {
+        std::size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            const std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) return false;                // đầy
+            else pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool try_pop(T& value) {
+        std::size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            const std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos + 1);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) return false;                // rỗng
+            else pos = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Phiên bản chờ: nhường CPU, rồi ngủ ngắn nếu tầng kia chậm (decode/encode có thể mất hàng chục ms)
+    void push(T value) { for (int k = 0; !try_push(value); ++k) backoff(k); }
+    T pop() { T value; for (int k = 0; !try_pop(value); ++k) backoff(k); return value; }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    static void backoff(int k) {
+        if (k < 64) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    std::unique_ptr<Cell[]> cells;
+    std::size_t mask = 0;
+    alignas(64) std::atomic<std::size_t> tail{0};
+    alignas(64) std::atomic<std::size_t> head{0};
+};
+
+// ================================================================
+// CHẾ ĐỘ BATCH: PIPELINE DECODE -> BLUR -> ENCODE
+// ================================================================
+
+// Một ảnh đi qua pipeline
+struct BatchImage {
+    std::string output;             // đường dẫn ảnh kết quả
+    uchar * pixels = nullptr;       // ảnh đã decode (stbi_load), làm buffer in của blur; nullptr nếu lỗi
+    uchar * scratch = nullptr;      // buffer out của blur
+    uchar * result = nullptr;       // buffer chứa kết quả (pixels hoặc scratch)
+    int width = 0, height = 0, channels = 0;
+};
+
+// Ảnh đầu vào được hỗ trợ bởi stb_image
+bool is_image_file(const std::filesystem::path& path) {
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char ch){ return char(std::tolower(ch)); });
+    for (const char * known : { ".jpg", ".jpeg", ".png", ".bmp", ".tga", ".psd", ".gif", ".hdr", ".pic", ".pnm", ".ppm", ".pgm" })
+        if (ext == known) return true;
+    return false;
+}
+
+//
+// Blur mọi ảnh của một thư mục:
+// - decoder threads: stbi_load từng file (lấy chỉ số file bằng atomic counter)
+// - thread chính: blur lần lượt từng ảnh, mỗi lần blur dùng toàn bộ backend đa luồng
+// - encoder threads: stbi_write_* rồi giải phóng buffer
+// Các tầng nối bằng BoundedQueue: tối đa vài ảnh đang chờ ở mỗi tầng, nên bộ nhớ bị giới hạn
+// bất kể thư mục lớn đến đâu, và mọi core đều bận trong lúc tầng khác đang chờ I/O.
+//
+int run_batch(int argc, char * argv[]) {
+    if (argc < 5) {
+        printf("%s --batch [input_dir] [output_dir] [sigma] [order - optional] [border - optional]\n", argv[0]);
+        return 1;
+    }
+    namespace fs = std::filesystem;
+    const fs::path input_dir(argv[2]), output_dir(argv[3]);
+    const float sigma = std::atof(argv[4]);
+    const int passes = argc > 5 ? std::atoi(argv[5]) : 3;
+    const Border border = parse_border(argc > 6 ? std::string(argv[6]) : "mirror");
+
+    std::vector<fs::path> files;
+    std::error_code error;
+    for (const fs::directory_entry& entry : fs::directory_iterator(input_dir, error))
+        if (entry.is_regular_file() && is_image_file(entry.path()))
+            files.push_back(entry.path());
+    if (error) {
+        printf("Lỗi: Không thể đọc thư mục %s\n", input_dir.string().c_str());
+        return 1;
+    }
+    std::sort(files.begin(), files.end());
+    fs::create_directories(output_dir, error);
+
+    // Chia core giữa các tầng: decoder và encoder mỗi tầng khoảng 1/4 số core, tầng blur nhận phần
+    // còn lại (ít nhất 1 worker). Decode/encode JPEG/PNG tốn CPU, nên các tầng không được dùng
+    // chung core với các worker của blur
+    const int cores = hardware_threads();
+    const int io_threads = std::max(1, cores / 4);
+    const int blur_threads = std::max(1, cores - 2 * io_threads);
+#ifdef _OPENMP
+    omp_set_num_threads(std::min(omp_get_max_threads(), blur_threads));
+#endif
+    BlurBackend& backend = blur_backend();         // thread pool / executor: trước lần blur đầu tiên
+    backend.threads = backend.threads > 0 ? std::min(backend.threads, blur_threads) : blur_threads;
+    const std::size_t total = files.size();
+    printf("Batch: %zu ảnh, %d decoder, %d encoder, %d blur worker, sigma = %.2f, passes = %d\n",
+           total, io_threads, io_threads, worker_count(), sigma, passes);
+
+    BoundedQueue<BatchImage> decoded(4), blurred(4);
+    std::atomic<std::size_t> next_file{0}, next_encode{0};
+    std::atomic<int> failures{0};
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> decoders, encoders;
+    for (int t = 0; t < io_threads; ++t) {
+        decoders.emplace_back([&] {
+            for (std::size_t i = next_file++; i < total; i = next_file++) {
+                BatchImage image;
+                fs::path output = output_dir / files[i].filename();
+                const std::string ext = output.extension().string();
+                if (ext != ".jpg" && ext != ".bmp" && ext != ".png")
+                    output.replace_extension(".png");
+                image.output = output.string();
+                image.pixels = stbi_load(files[i].string().c_str(), &image.width, &image.height, &image.channels, 0);
+                decoded.push(std::move(image));     // ảnh lỗi vẫn được đẩy đi để mọi tầng đếm đủ total
+            }
+        });
+        encoders.emplace_back([&] {
+            while (next_encode++ < total) {
+                BatchImage image = blurred.pop();
+                if (!image.result || !save_image(image.output, image.width, image.height, image.channels, image.result))
+                    ++failures;
+                stbi_image_free(image.pixels);
+                first_touch_free(image.scratch);
+            }
+        });
+    }
+
+    for (std::size_t i = 0; i < total; ++i) {
+        BatchImage image = decoded.pop();
+        if (image.pixels) {
+            uchar * in = image.pixels;
+            uchar * out = image.scratch = first_touch_alloc<uchar>(std::size_t(image.width) * image.height * image.channels, false);
+            fast_gaussian_blur(in, out, image.width, image.height, image.channels, sigma, passes, border);
+            image.result = out;
+        }
+        blurred.push(std::move(image));
+    }
+
+    for (std::thread& thread : decoders) thread.join();
+    for (std::thread& thread : encoders) thread.join();
+    const auto end = std::chrono::high_resolution_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    printf("Đã xử lý %zu ảnh (%d lỗi) trong %.3f s (%.1f ảnh/s)\n",
+           total, failures.load(), seconds, seconds > 0 ? total / seconds : 0.0);
+    return failures.load() == 0 ? 0 : 1;
+}
+
+// ================================================================
+// CHẾ ĐỘ MMAP: ẢNH RAW / PNM / PFM KHÔNG QUA BUFFER TRUNG GIAN
+// ================================================================
+// File input được ánh xạ MAP_PRIVATE và dùng trực tiếp làm buffer in của blur (blur dùng in làm
+// vùng nháp: các trang bị ghi được kernel copy-on-write, file gốc không đổi); file output được
+// ánh xạ MAP_SHARED và dùng làm buffer out, kết quả được kernel ghi ra đĩa. Với input đã nằm trong
+// page cache, chi phí chỉ còn phần tính toán.
+// Chỉ có trên hệ POSIX; trên Windows --mmap quay về đọc/ghi ảnh qua stb (xem run_mmap ở nhánh #else).
+
+#if !defined(_WIN32)
+
+// Ảnh ánh xạ từ file
+struct MappedImage {
+    unsigned char * base = nullptr; // địa chỉ ánh xạ của cả file
+    std::size_t bytes = 0;          // kích thước file
+    std::size_t offset = 0;         // vị trí bắt đầu dữ liệu pixel (sau header)
+    int width = 0, height = 0, channels = 0;
+    bool is_float = false;          // PFM hoặc raw float32
+    char magic = 0;                 // '5'/'6' (PGM/PPM), 'f'/'F' (PFM), 0 (raw không header)
+
+    std::size_t data_bytes() const {
+        return std::size_t(width) * height * channels * (is_float ? sizeof(float) : 1);
+    }
+};
+
+// Kích thước ảnh raw dạng "WxHxC" (uint8) hoặc "WxHxCf" (float32)
+bool parse_geometry(const std::string& text, MappedImage& image) {
+    char suffix = 0;
+    const int fields = std::sscanf(text.c_str(), "%dx%dx%d%c", &image.width, &image.height, &image.channels, &suffix);
+    image.is_float = fields == 4 && suffix == 'f';
+    return (fields == 3 || image.is_float) && image.width > 0 && image.height > 0
+        && image.channels >= 1 && image.channels <= 4;
+}
+
+// Đọc header PGM/PPM nhị phân (P5/P6, maxval = 255) hoặc PFM (Pf/PF, little-endian). Như
+// parse_geometry, kích thước phải dương: ảnh 0 pixel vẫn qua được kiểm tra kích thước file.
+bool parse_pnm_header(MappedImage& image) {
+    const char * p = reinterpret_cast<const char *>(image.base);
+    const char * end = p + image.bytes;
+    if (image.bytes < 3 || p[0] != 'P' || (p[1] != '5' && p[1] != '6' && p[1] != 'f' && p[1] != 'F'))
+        return false;
+    image.magic = p[1];
+    p += 2;
+
+    // 3 trường tiếp theo: width, height, maxval (PNM) hoặc scale (PFM); bỏ qua comment '#'
+    std::string fields[3];
+    for (std::string& field : fields) {
+        while (p < end && (std::isspace((unsigned char)*p) || *p == '#'))
+            if (*p == '#') while (p < end && *p != '\n') ++p;
+            else ++p;
+        while (p < end && !std::isspace((unsigned char)*p)) field += *p++;
+    }
+    if (p >= end) return false;
+    ++p;                            // đúng một ký tự trắng trước dữ liệu
+
+    image.width = std::atoi(fields[0].c_str());
+    image.height = std::atoi(fields[1].c_str());
+    image.is_float = image.magic == 'f' || image.magic == 'F';
+    image.channels = image.magic == '5' || image.magic == 'f' ? 1 : 3;
+    image.offset = p - reinterpret_cast<const char *>(image.base);
+    if (image.width <= 0 || image.height <= 0)
+        return false;
+    if (image.is_float)
+        return std::atof(fields[2].c_str()) < 0;    // scale âm = little-endian
+    const int maxval = std::atoi(fields[2].c_str());
+    return maxval == 255;           // output luôn ghi maxval 255
+}
+
+void unmap_image(MappedImage& image) {
+    if (image.base) munmap(image.base, image.bytes);
+    image.base = nullptr;
+}
+
+// Ánh xạ file input; geometry khác rỗng nghĩa là file raw không header
+bool map_input(const char * path, const std::string& geometry, MappedImage& image) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) { close(fd); return false; }
+    image.bytes = std::size_t(info.st_size);
+    void * base = mmap(nullptr, image.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+    image.base = static_cast<unsigned char *>(base);
+    madvise(base, image.bytes, MADV_WILLNEED);
+
+    const bool valid = geometry.empty() ? parse_pnm_header(image) : parse_geometry(geometry, image);
+    if (!valid || image.bytes < image.offset + image.data_bytes()) {
+        unmap_image(image);
+        return false;
+    }
+    return true;
+}
+
+// Tạo file output cùng định dạng với input và ánh xạ MAP_SHARED. Header PFM được đệm để dữ liệu
+// float bắt đầu ở địa chỉ chia hết cho 4
+bool map_output(const char * path, const MappedImage& like, MappedImage& image) {
+    image = like;
+    std::string header;
+    if (like.magic) {
+        header = "P" + std::string(1, like.magic) + "\n"
+               + std::to_string(like.width) + " " + std::to_string(like.height) + "\n";
+        if (like.is_float) {
+            header += "-1";
+            if ((header.size() + 1) % sizeof(float) != 0) header += ".";
+            while ((header.size() + 1) % sizeof(float) != 0) header += "0";
+        }
+        else header += "255";
+        header += "\n";
+    }
+    image.offset = header.size();
+    image.bytes = image.offset + image.data_bytes();
+
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    if (ftruncate(fd, off_t(image.bytes)) != 0) { close(fd); return false; }
+    void * base = mmap(nullptr, image.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) { image.base = nullptr; return false; }
+    image.base = static_cast<unsigned char *>(base);
+    std::memcpy(image.base, header.data(), header.size());
+    return true;
+}
+
+// Blur từ ảnh input ánh xạ sang ảnh output ánh xạ
+template<typename T>
+void blur_mapped(MappedImage& input, MappedImage& output, float sigma, int passes, Border border) {
+    T * in = reinterpret_cast<T *>(input.base + input.offset);
+    T * out = reinterpret_cast<T *>(output.base + output.offset);
+    T * const target = out;
+    T * aligned = nullptr;
+    if (reinterpret_cast<std::uintptr_t>(in) % alignof(T) != 0) {
+        // header PFM không căn lề: không thể dùng trực tiếp buffer ánh xạ làm float*
+        printf("Cảnh báo: dữ liệu input không căn lề %zu byte, phải copy một lần\n", alignof(T));
+        aligned = first_touch_alloc<T>(input.data_bytes() / sizeof(T), false);
+        std::memcpy(aligned, in, input.data_bytes());
+        in = aligned;
+    }
+
+    fast_gaussian_blur(in, out, input.width, input.height, input.channels, sigma, passes, border);
+    // pipeline tĩnh (chế độ NUMA) có thể trả kết quả trong buffer in
+    if (out != target)
+        std::memcpy(target, out, output.data_bytes());
+    first_touch_free(aligned);
+}
+
+//
+// Blur một ảnh raw/PNM/PFM bằng mmap, không decode/encode và không có buffer trung gian:
+//   fastblur --mmap [input] [output] [sigma] [order] [border] [WxHxC[f] - chỉ với raw]
+//
+int run_mmap(int argc, char * argv[]) {
+    if (argc < 5) {
+        printf("%s --mmap [input] [output] [sigma] [order - optional] [border - optional] [WxHxC[f] - raw only]\n", argv[0]);
+        return 1;
+    }
+    const float sigma = std::atof(argv[4]);
+    const int passes = argc > 5 ? std::atoi(argv[5]) : 3;
+    const Border border = parse_border(argc > 6 ? std::string(argv[6]) : "mirror");
+    const std::string geometry = argc > 7 ? argv[7] : "";
+
+    MappedImage input, output;
+    if (!map_input(argv[2], geometry, input)) {
+        printf("Lỗi: Không thể ánh xạ ảnh %s (cần PGM/PPM 8 bit maxval 255, PFM little-endian, hoặc raw với WxHxC[f])\n", argv[2]);
+        return 1;
+    }
+    if (!map_output(argv[3], input, output)) {
+        printf("Lỗi: Không thể tạo file %s\n", argv[3]);
+        unmap_image(input);
+        return 1;
+    }
+    printf("Ảnh %dx%d, %d kênh, %s\n", input.width, input.height, input.channels,
+           input.is_float ? "float32" : "uint8");
+
+    const auto start = std::chrono::high_resolution_clock::now();
+    if (input.is_float)
+        blur_mapped<float>(input, output, sigma, passes, border);
+    else
+        blur_mapped<uchar>(input, output, sigma, passes, border);
+    const auto end = std::chrono::high_resolution_clock::now();
+    print_detailed_time("Blur (mmap)", start, end);
+
+    unmap_image(input);
+    unmap_image(output);
+    return 0;
+}
+
+#else
+
+//
+// Không có mmap: đọc ảnh bằng stb, blur và lưu như chế độ thường (không hỗ trợ raw WxHxC và PFM)
+//
+int run_mmap(int argc, char * argv[]) {
+    if (argc < 5) {
+        printf("%s --mmap [input] [output] [sigma] [order - optional] [border - optional] [WxHxC[f] - raw only]\n", argv[0]);
+        return 1;
+    }
+    printf("mmap not supported: --mmap dùng stb load/save trên nền tảng này\n");
+    if (argc > 7) {
+        printf("Lỗi: ảnh raw (WxHxC[f]) cần mmap\n");
+        return 1;
+    }
+    const float sigma = std::atof(argv[4]);
+    const int passes = argc > 5 ? std::atoi(argv[5]) : 3;
+    const Border border = parse_border(argc > 6 ? std::string(argv[6]) : "mirror");
+
+    int width, height, channels;
+    uchar * image_data = stbi_load(argv[2], &width, &height, &channels, 0);
+    if (!image_data) {
+        printf("Lỗi: Không thể load ảnh từ file %s\n", argv[2]);
+        return 1;
+    }
+    printf("Ảnh %dx%d, %d kênh, uint8\n", width, height, channels);
+
+    uchar * output = first_touch_alloc<uchar>(std::size_t(width) * height * channels);
+    uchar * in = image_data;
+    uchar * out = output;
+    const auto start = std::chrono::high_resolution_clock::now();
+    fast_gaussian_blur(in, out, width, height, channels, sigma, passes, border);
+    const auto end = std::chrono::high_resolution_clock::now();
+    print_detailed_time("Blur", start, end);
+
+    const bool saved = save_image(argv[3], width, height, channels, out);
+    if (!saved)
+        printf("Lỗi: Không thể tạo file %s\n", argv[3]);
+    stbi_image_free(image_data);
+    first_touch_free(output);
+    return saved ? 0 : 1;
+}
+
+#endif
+
 // ================================================================
 // HÀM CHÍNH
 // ================================================================
 int main(int argc, char * argv[])
 {   
+    // Chế độ batch: blur cả thư mục
+    if( argc > 1 && std::string(argv[1]) == "--batch" )
+        return run_batch(argc, argv);
+
+    // Chế độ mmap: ảnh raw/PNM/PFM không qua buffer trung gian
+    if( argc > 1 && std::string(argv[1]) == "--mmap" )
+        return run_mmap(argc, argv);
+
+    // Cờ --compare: chạy thêm một lần single-threaded và in bảng so sánh hiệu năng
+    bool compare = false;
+    std::vector<char *> args;
+    for (int i = 0; i < argc; ++i)
+    {
+        if( std::string(argv[i]) == "--compare" ) compare = true;
+        else args.push_back(argv[i]);
+    }
+    argc = int(args.size());
+    argv = args.data();
+
     // Kiểm tra số lượng tham số truyền vào
     if( argc < 4 )
     {
         // In hướng dẫn sử dụng
-        printf("%s [input] [output] [sigma] [order - optional] [border - optional]\n", argv[0]);
+        printf("%s [input] [output] [sigma] [order - optional] [border - optional] [--compare]\n", argv[0]);
+        printf("%s --batch [input_dir] [output_dir] [sigma] [order - optional] [border - optional]\n", argv[0]);
+        printf("%s --mmap [input] [output] [sigma] [order - optional] [border - optional] [WxHxC[f] - raw only]\n", argv[0]);
         printf("\n");
         printf("- input:  file ảnh input (jpg/png/bmp/...)\n");
         printf("- output: file ảnh output muốn lưu (.png/.jpg/.bmp)\n");
         printf("- sigma:  độ mờ Gaussian (float, > 0)\n");
         printf("- order:  số lần blur (bộ lọc box đa cấp), mặc định = 3\n");
         printf("- border: cách xử lý biên ảnh [mirror, extend, crop, wrap]\n");
+        printf("- --compare: chạy thêm bản single-threaded và so sánh hiệu năng\n");
         printf("\n");
         exit(1);                     // Thoát chương trình vì thiếu tham số
     }
@@ -127,7 +629,10 @@ int main(int argc, char * argv[])
 
     printf("\n");
     printf("╔═══════════════════════════════════════════════════════════════════════╗\n");
-    printf("║          FAST GAUSSIAN BLUR - SO SÁNH HIỆU NĂNG                       ║\n");
+    if( compare )
+        printf("║          FAST GAUSSIAN BLUR - SO SÁNH HIỆU NĂNG                       ║\n");
+    else
+        printf("║          FAST GAUSSIAN BLUR                                           ║\n");
     printf("╚═══════════════════════════════════════════════════════════════════════╝\n");
     printf("\n");
     printf("Source image: %s\n", argv[1]);
@@ -154,12 +659,7 @@ int main(int argc, char * argv[])
                                 ? std::string(argv[5])
                                 : "mirror";   // Cách xử lý biên
 
-    Border border;
-    if (policy == "mirror")         border = Border::kMirror;
-    else if (policy == "extend")    border = Border::kExtend;
-    else if (policy == "crop")      border = Border::kKernelCrop;
-    else if (policy == "wrap")      border = Border::kWrap;
-    else                            border = Border::kMirror; // Default
+    const Border border = parse_border(policy);
 
     printf("Tham số xử lý:\n");
     printf("  - Sigma: %.2f\n", sigma);
@@ -168,35 +668,44 @@ int main(int argc, char * argv[])
     printf("\n");
 
     // =====================
-    // 3) TẠO BỘ ĐỆM (BUFFER) CHO CẢ HAI PHIÊN BẢN
+    // 3) TẠO BỘ ĐỆM (BUFFER)
     // =====================
 
-    std::size_t size = width * height * channels; // số phần tử pixel tổng cộng
-
-    // Buffer cho phiên bản có OpenMP (multi-threaded)
-    uchar * new_image_omp = new uchar[size];
-    uchar * old_image_omp = new uchar[size];
-    
-    // Buffer cho phiên bản không có OpenMP (single-threaded)
-    uchar * new_image_no_omp = new uchar[size];
-    uchar * old_image_no_omp = new uchar[size];
+    std::size_t size = std::size_t(width) * height * channels; // số phần tử pixel tổng cộng
 
-    // =====================
-    // 4) COPY DỮ LIỆU ẢNH VÀO BUFFER
-    // =====================
+    // Buffer input: dùng lại chính ảnh stb vừa decode, chỉ cần thêm một buffer out.
+    // Chế độ NUMA (numa_bands trong FGB_PLAN_FILE): gắn thread vào CPU và chuyển ảnh sang buffer
+    // first-touch để mỗi trang nhớ nằm trên node của thread sẽ xử lý nó, rồi trả lại buffer stb
+    uchar * input = image_data;
+    if( blur_plan().numa_bands )
+    {
+        pin_threads();
+        input = first_touch_alloc<uchar>(size, false);
+        first_touch_copy(input, image_data, size);
+        stbi_image_free(image_data);
+        image_data = nullptr;
+    }
+    uchar * output = first_touch_alloc<uchar>(size);
 
-    for(std::size_t i = 0; i < size; ++i)
+    // --compare: giữ một bản ảnh gốc cho lần chạy single-threaded (lần blur đầu ghi đè input)
+    uchar * compare_input = nullptr;
+    uchar * compare_output = nullptr;
+    if( compare )
     {
-        old_image_omp[i] = image_data[i];
-        old_image_no_omp[i] = image_data[i];
+        compare_input = first_touch_alloc<uchar>(size, false);
+        first_touch_copy(compare_input, input, size);
+        compare_output = first_touch_alloc<uchar>(size);
     }
 
     // =====================
-    // 5) CHẠY PHIÊN BẢN CÓ OPENMP (MULTI-THREADED)
+    // 4) CHẠY BLUR (MULTI-THREADED)
     // =====================
-    printf("╔═══════════════════════════════════════════════════════════════════════╗\n");
-    printf("║  PHIÊN BẢN CÓ OPENMP (Song song hóa - Multi-threaded)                ║\n");
-    printf("╚═══════════════════════════════════════════════════════════════════════╝\n");
+    if( compare )
+    {
+        printf("╔═══════════════════════════════════════════════════════════════════════╗\n");
+        printf("║  PHIÊN BẢN CÓ OPENMP (Song song hóa - Multi-threaded)                ║\n");
+        printf("╚═══════════════════════════════════════════════════════════════════════╝\n");
+    }
     
 #ifdef _OPENMP
     // Đảm bảo sử dụng tất cả threads có sẵn
@@ -207,9 +716,13 @@ int main(int argc, char * argv[])
 #endif
     printf("\n");
     
+    // in/out là tham chiếu: sau khi blur, out trỏ tới buffer chứa kết quả
+    uchar * in = input;
+    uchar * out = output;
+
     auto start_omp = std::chrono::high_resolution_clock::now();
     
-    fast_gaussian_blur(old_image_omp, new_image_omp,
+    fast_gaussian_blur(in, out,
                        width, height, channels,
                        sigma, passes, border);
     
@@ -221,84 +734,72 @@ int main(int argc, char * argv[])
     printf("\n");
 
     // =====================
-    // 6) CHẠY PHIÊN BẢN KHÔNG CÓ OPENMP (SINGLE-THREADED)
+    // 5) --compare: CHẠY PHIÊN BẢN SINGLE-THREADED VÀ SO SÁNH
     // =====================
-    printf("╔═══════════════════════════════════════════════════════════════════════╗\n");
-    printf("║  PHIÊN BẢN KHÔNG CÓ OPENMP (Single-threaded)                         ║\n");
-    printf("╚═══════════════════════════════════════════════════════════════════════╝\n");
-    
+    if( compare )
+    {
+        printf("╔═══════════════════════════════════════════════════════════════════════╗\n");
+        printf("║  PHIÊN BẢN KHÔNG CÓ OPENMP (Single-threaded)                         ║\n");
+        printf("╚═══════════════════════════════════════════════════════════════════════╝\n");
+        
 #ifdef _OPENMP
-    // Đặt số threads = 1 để mô phỏng single-threaded
-    omp_set_num_threads(1);
-    printf("Số threads: 1 (single-threaded)\n");
+        // Đặt số threads = 1 để mô phỏng single-threaded (pipeline tĩnh NUMA dùng OpenMP trực tiếp)
+        const int omp_threads = omp_get_max_threads();
+        omp_set_num_threads(1);
+        printf("Số threads: 1 (single-threaded)\n");
 #else
-    printf("OpenMP không có sẵn, đã chạy single-threaded\n");
+        printf("OpenMP không có sẵn, đã chạy single-threaded\n");
 #endif
-    printf("\n");
-    
-    auto start_no_omp = std::chrono::high_resolution_clock::now();
-    
-    fast_gaussian_blur(old_image_no_omp, new_image_no_omp,
-                       width, height, channels,
-                       sigma, passes, border);
-    
-    auto end_no_omp = std::chrono::high_resolution_clock::now();
-    auto duration_no_omp = end_no_omp - start_no_omp;
-    double time_no_omp_ms = std::chrono::duration_cast<std::chrono::microseconds>(duration_no_omp).count() / 1000.0;
-    
-    print_detailed_time("Tổng thời gian xử lý", start_no_omp, end_no_omp);
-    printf("\n");
-
-    // =====================
-    // 7) HIỂN THỊ KẾT QUẢ SO SÁNH
-    // =====================
-    print_comparison_table(time_omp_ms, time_no_omp_ms);
+        printf("\n");
 
-    // =====================
-    // 8) COPY KẾT QUẢ BLUR VỀ image_data ĐỂ LƯU FILE
-    // (Sử dụng kết quả từ phiên bản có OpenMP)
-    // =====================
+        // Các pass còn lại chạy qua run_workers: ép backend tuần tự, nếu không FGB_BACKEND=pool
+        // (hay executor) vẫn chạy trên nhiều worker và tỉ lệ tăng tốc bị sai
+        BlurBackend & backend = blur_backend();
+        const Backend backend_kind = backend.kind;
+        backend.kind = kBackendSerial;
+        
+        auto start_no_omp = std::chrono::high_resolution_clock::now();
+        
+        fast_gaussian_blur(compare_input, compare_output,
+                           width, height, channels,
+                           sigma, passes, border);
+        
+        auto end_no_omp = std::chrono::high_resolution_clock::now();
+
+        backend.kind = backend_kind;
+#ifdef _OPENMP
+        omp_set_num_threads(omp_threads);
+#endif
+        auto duration_no_omp = end_no_omp - start_no_omp;
+        double time_no_omp_ms = std::chrono::duration_cast<std::chrono::microseconds>(duration_no_omp).count() / 1000.0;
+        
+        print_detailed_time("Tổng thời gian xử lý", start_no_omp, end_no_omp);
+        printf("\n");
 
-    for(std::size_t i = 0; i < size; ++i)
-    {
-        image_data[i] = (uchar)(new_image_omp[i]);
+        print_comparison_table(time_omp_ms, time_no_omp_ms);
     }
 
     // =====================
-    // 9) LƯU ẢNH RA FILE
+    // 6) LƯU ẢNH RA FILE (trực tiếp từ buffer kết quả, không copy)
     // =====================
-    std::string file(argv[2]);
-    std::string ext = file.substr(file.size()-3);  // Lấy phần .png/.jpg...
-
-    if( ext == "bmp" )
-        stbi_write_bmp(argv[2], width, height, channels, image_data);
-    else if( ext == "jpg" )
-        stbi_write_jpg(argv[2], width, height, channels, image_data, 90); // chất lượng 90%
+    const bool saved = save_image(argv[2], width, height, channels, out);
+    if (saved)
+        printf("Đã lưu ảnh kết quả vào: %s\n", argv[2]);
     else
-    {
-        // Nếu không phải png thì chuyển về png
-        if( ext != "png" )
-        {
-            printf("Image format '%s' not supported, writing default png\n",
-                   ext.c_str()); 
-            file = file.substr(0, file.size()-4) + std::string(".png");
-        }
-        stbi_write_png(file.c_str(), width, height, channels,
-                       image_data, channels * width); // stride = width*channels
-    }
-    
-    printf("Đã lưu ảnh kết quả vào: %s\n", argv[2]);
+        printf("Lỗi: Không thể tạo file %s\n", argv[2]);
     printf("\n");
 
     // =====================
-    // 10) GIẢI PHÓNG BỘ NHỚ
+    // 7) GIẢI PHÓNG BỘ NHỚ
     // =====================
 
-    stbi_image_free(image_data);   // Giải phóng ảnh load từ file
-    delete[] new_image_omp;         // Giải phóng buffer kết quả
-    delete[] old_image_omp;         // Giải phóng buffer input
-    delete[] new_image_no_omp;      // Giải phóng buffer kết quả
-    delete[] old_image_no_omp;      // Giải phóng buffer input
+    if( image_data )
+        stbi_image_free(image_data);    // Giải phóng ảnh load từ file (buffer input)
+    else
+        first_touch_free(input);        // Buffer input first-touch (chế độ NUMA)
+    first_touch_free(output);           // Giải phóng buffer out
+    first_touch_free(compare_input);    // Buffer của lần chạy --compare (nullptr nếu không dùng)
+    first_touch_free(compare_output);
 
-    return 0;
+    return saved ? 0 : 1;
 }